@@ -5,50 +5,196 @@
 #include <linux/uaccess.h>
 #include <linux/device.h>
 #include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/slab.h>
+#include <linux/kfifo.h>
+#include <linux/ktime.h>
+
+#include "sensor_abi.h"
 
 #define DEV_NAME "mybh"
 #define I2C_BUS_NUM    1
 #define BH1750_ADDR    0x23
+#define BH1750_MEAS_MS 180 // H-resolution 최대 측정 시간
+#define FIFO_MINOR     1   // /dev/mybh_fifo (연속 모드에서만 생성)
+#define FIFO_RECORDS   256
+
+/*
+ * continuous=1 이면 센서를 연속 측정 모드로 두고 delayed_work가 interval_ms마다
+ * 값을 읽어 캐시한다. read()는 캐시를 바로 돌려주고, 새 샘플이 들어오면 poll()이 깨어난다.
+ * 같은 샘플은 /dev/mybh_fifo 의 kfifo에도 쌓여 read() 한 번에 여러 건을 꺼낼 수 있다.
+ * i2c_bus로 어댑터를 바꿀 수 있어 실제 센서 없이 i2c-stub으로 시험할 수 있다:
+ *   modprobe i2c-stub chip_addr=0x23
+ *   i2cset -y <버스> 0x23 0x10 0x9001 w     # 센서는 MSB 먼저: raw 0x0190 -> 480 lux
+ *   insmod BH1750_drv.ko i2c_bus=<버스> continuous=1
+ */
+static int i2c_bus = I2C_BUS_NUM;
+module_param(i2c_bus, int, 0444);
+MODULE_PARM_DESC(i2c_bus, "I2C adapter number (default 1)");
+
+static bool continuous;
+module_param(continuous, bool, 0444);
+MODULE_PARM_DESC(continuous, "Run the sensor in continuous mode and cache samples");
+
+static unsigned int interval_ms = 200;
+module_param(interval_ms, uint, 0444);
+MODULE_PARM_DESC(interval_ms, "Cache refresh period in continuous mode (ms)");
 
 static struct i2c_adapter *i2c_adap;
 static struct i2c_client *i2c_client;
 static int major_num;
 static struct class *bh1750_class;
 static struct device *bh1750_device;
-static DEFINE_MUTEX(bh1750_mutex);
+static struct device *bh1750_fifo_device;
+static DEFINE_MUTEX(bh1750_mutex); // I2C 트랜잭션 직렬화
 
 static const unsigned char init_seq[] = { 0x01 };
 static const unsigned char one_time_h_resolution_mode[] = { 0x10 };
 
+/* 연속 모드 캐시 */
+static DEFINE_SPINLOCK(cache_lock);
+static int cached_lux;
+static u32 sample_seq; // 새 샘플마다 증가, 0이면 아직 없음
+static DECLARE_WAIT_QUEUE_HEAD(sample_wq);
+static struct delayed_work sample_work;
+
+/* 샘플 기록 (생산자: sample_work, 소비자: fifo_read) */
+static DEFINE_KFIFO(sample_fifo, struct bh1750_record, FIFO_RECORDS);
+static DEFINE_MUTEX(fifo_read_mutex);
+static DECLARE_WAIT_QUEUE_HEAD(fifo_wq);
+static u32 fifo_lost;
+
+/* 열린 파일마다 마지막으로 읽은 샘플 번호 */
+struct bh1750_file {
+    u32 seen_seq;
+};
+
+/* I2C_FUNC_I2C가 없는 SMBus 전용 어댑터(i2c-stub 등)에서는 SMBus 명령으로 대신한다 */
+static bool use_smbus(void)
+{
+    return !i2c_check_functionality(i2c_client->adapter, I2C_FUNC_I2C);
+}
+
+static int bh1750_send_cmd(const unsigned char *cmd)
+{
+    int ret;
+
+    if (use_smbus())
+        return i2c_smbus_write_byte(i2c_client, cmd[0]);
+    ret = i2c_master_send(i2c_client, cmd, 1);
+    return ret == 1 ? 0 : -EIO;
+}
+
+/* 측정값을 읽어 lux로 변환 */
+static int bh1750_read_lux(int *lux)
+{
+    uint8_t data[2];
+    int ret;
+
+    if (use_smbus()) {
+        // 측정 명령 바이트 뒤에 2바이트 읽기 (i2c-stub에서는 해당 레지스터 word)
+        ret = i2c_smbus_read_word_swapped(i2c_client, one_time_h_resolution_mode[0]);
+        if (ret < 0)
+            return ret;
+        data[0] = ret >> 8;
+        data[1] = ret & 0xff;
+    } else {
+        ret = i2c_master_recv(i2c_client, data, 2);
+        if (ret != 2)
+            return -EIO;
+    }
+
+    // lux 계산 (실수 오차 줄이기 위해 1.2 대신 12/10 사용)
+    *lux = (((data[0] << 8) | data[1]) * 12) / 10;
+    return 0;
+}
+
+static void sample_work_fn(struct work_struct *work)
+{
+    int lux, ret;
+
+    mutex_lock(&bh1750_mutex);
+    ret = bh1750_read_lux(&lux);
+    mutex_unlock(&bh1750_mutex);
+
+    if (ret == 0) {
+        struct bh1750_record rec = {
+            .timestamp_ns = ktime_get_ns(),
+            .lux = lux,
+        };
+
+        spin_lock(&cache_lock);
+        cached_lux = lux;
+        sample_seq++;
+        if (sample_seq == 0)
+            sample_seq = 1;
+        rec.seq = sample_seq;
+        spin_unlock(&cache_lock);
+        wake_up_interruptible(&sample_wq);
+
+        rec.lost = fifo_lost;
+        if (kfifo_put(&sample_fifo, rec)) {
+            fifo_lost = 0;
+            wake_up_interruptible(&fifo_wq);
+        } else {
+            fifo_lost++; // 읽는 쪽이 밀림
+        }
+    } else {
+        pr_err("BH1750: Failed to receive data\n");
+    }
+    schedule_delayed_work(&sample_work, msecs_to_jiffies(interval_ms));
+}
+
 static ssize_t dev_read(struct file *file, char __user *buf, size_t len, loff_t *offset)
 {
+    struct bh1750_file *bf = file->private_data;
     char msg[32];
-    uint8_t data[2];
     int ret, lux;
 
+    if (continuous) {
+        u32 seq;
+
+        // 첫 샘플이 나오기 전에만 기다린다. 그 뒤로는 캐시를 바로 반환
+        if (!READ_ONCE(sample_seq)) {
+            if (file->f_flags & O_NONBLOCK)
+                return -EAGAIN;
+            if (wait_event_interruptible(sample_wq, READ_ONCE(sample_seq) != 0))
+                return -ERESTARTSYS;
+        }
+        spin_lock(&cache_lock);
+        lux = cached_lux;
+        seq = sample_seq;
+        spin_unlock(&cache_lock);
+        bf->seen_seq = seq;
+
+        snprintf(msg, sizeof(msg), "%d lux\n", lux);
+        *offset = 0;
+        return simple_read_from_buffer(buf, len, offset, msg, strlen(msg));
+    }
+
     mutex_lock(&bh1750_mutex);
 
     // 측정 명령 전송
-    ret = i2c_master_send(i2c_client, one_time_h_resolution_mode, sizeof(one_time_h_resolution_mode));
-    if (ret != sizeof(one_time_h_resolution_mode)) {
+    ret = bh1750_send_cmd(one_time_h_resolution_mode);
+    if (ret < 0) {
         pr_err("BH1750: Failed to send measure command\n");
         mutex_unlock(&bh1750_mutex);
         return -EIO;
     }
 
-    msleep(180); // 데이터시트 권장 대기시간
+    msleep(BH1750_MEAS_MS); // 데이터시트 권장 대기시간
 
     // 데이터 수신
-    ret = i2c_master_recv(i2c_client, data, 2);
-    if (ret != 2) {
+    ret = bh1750_read_lux(&lux);
+    if (ret < 0) {
         pr_err("BH1750: Failed to receive data\n");
         mutex_unlock(&bh1750_mutex);
         return -EIO;
     }
 
-    // lux 계산 (실수 오차 줄이기 위해 1.2 대신 12/10 사용)
-    lux = (((data[0] << 8) | data[1]) * 12) / 10;
-
     snprintf(msg, sizeof(msg), "%d lux\n", lux);
 
     *offset = 0;
@@ -57,14 +203,83 @@ static ssize_t dev_read(struct file *file, char __user *buf, size_t len, loff_t
     return ret;
 }
 
-static int dev_open(struct inode *inode, struct file *file) { return 0; }
-static int dev_release(struct inode *inode, struct file *file) { return 0; }
+/* 연속 모드: 마지막 read 이후 새 샘플이 있으면 읽기 가능. 단발 모드는 항상 읽기 가능 */
+static __poll_t dev_poll(struct file *file, poll_table *wait)
+{
+    struct bh1750_file *bf = file->private_data;
+
+    if (!continuous)
+        return EPOLLIN | EPOLLRDNORM;
+    poll_wait(file, &sample_wq, wait);
+    if (READ_ONCE(sample_seq) != bf->seen_seq)
+        return EPOLLIN | EPOLLRDNORM;
+    return 0;
+}
+
+/* 쌓인 레코드를 한 번에 최대한 꺼낸다 */
+static ssize_t fifo_read(struct file *file, char __user *buf, size_t len, loff_t *offset)
+{
+    unsigned int copied;
+    int ret;
+
+    if (len < sizeof(struct bh1750_record))
+        return -EINVAL;
+    len -= len % sizeof(struct bh1750_record);
+
+    if (kfifo_is_empty(&sample_fifo)) {
+        if (file->f_flags & O_NONBLOCK)
+            return -EAGAIN;
+        if (wait_event_interruptible(fifo_wq, !kfifo_is_empty(&sample_fifo)))
+            return -ERESTARTSYS;
+    }
+    mutex_lock(&fifo_read_mutex);
+    ret = kfifo_to_user(&sample_fifo, buf, len, &copied);
+    mutex_unlock(&fifo_read_mutex);
+    return ret ? ret : copied;
+}
+
+static __poll_t fifo_poll(struct file *file, poll_table *wait)
+{
+    poll_wait(file, &fifo_wq, wait);
+    return kfifo_is_empty(&sample_fifo) ? 0 : EPOLLIN | EPOLLRDNORM;
+}
+
+static ssize_t read_dispatch(struct file *file, char __user *buf, size_t len, loff_t *offset)
+{
+    if (iminor(file_inode(file)) == FIFO_MINOR)
+        return fifo_read(file, buf, len, offset);
+    return dev_read(file, buf, len, offset);
+}
+
+static __poll_t poll_dispatch(struct file *file, poll_table *wait)
+{
+    if (iminor(file_inode(file)) == FIFO_MINOR)
+        return fifo_poll(file, wait);
+    return dev_poll(file, wait);
+}
+
+static int dev_open(struct inode *inode, struct file *file)
+{
+    struct bh1750_file *bf = kzalloc(sizeof(*bf), GFP_KERNEL);
+
+    if (!bf)
+        return -ENOMEM;
+    file->private_data = bf;
+    return 0;
+}
+
+static int dev_release(struct inode *inode, struct file *file)
+{
+    kfree(file->private_data);
+    return 0;
+}
 
 static struct file_operations fops = {
     .owner = THIS_MODULE,
     .open = dev_open,
     .release = dev_release,
-    .read = dev_read,
+    .read = read_dispatch,
+    .poll = poll_dispatch,
 };
 
 static int __init bh1750_init(void)
@@ -74,27 +289,40 @@ static int __init bh1750_init(void)
     };
     int ret;
 
-    i2c_adap = i2c_get_adapter(I2C_BUS_NUM);
+    INIT_DELAYED_WORK(&sample_work, sample_work_fn);
+
+    i2c_adap = i2c_get_adapter(i2c_bus);
     if (!i2c_adap) {
         pr_err("I2C adapter not found\n");
         return -ENODEV;
     }
 
     i2c_client = i2c_new_client_device(i2c_adap, &board_info);
-    if (!i2c_client) {
+    if (IS_ERR(i2c_client)) {
         pr_err("Device registration failed\n");
         ret = -ENODEV;
         goto put_adapter;
     }
 
     // 초기화 명령 전송
-    ret = i2c_master_send(i2c_client, init_seq, sizeof(init_seq));
-    if (ret != sizeof(init_seq)) {
+    ret = bh1750_send_cmd(init_seq);
+    if (ret < 0) {
         pr_err("BH1750: Init command failed\n");
         ret = -EIO;
         goto unregister_client;
     }
 
+    if (continuous) {
+        // 0x10은 데이터시트상 연속 H-resolution 명령. 첫 변환이 끝난 뒤부터 캐시 갱신
+        ret = bh1750_send_cmd(one_time_h_resolution_mode);
+        if (ret < 0) {
+            pr_err("BH1750: Failed to send measure command\n");
+            ret = -EIO;
+            goto unregister_client;
+        }
+        schedule_delayed_work(&sample_work, msecs_to_jiffies(BH1750_MEAS_MS));
+    }
+
     major_num = register_chrdev(0, DEV_NAME, &fops);
     if (major_num < 0) {
         pr_err("Device registration failed\n");
@@ -116,14 +344,28 @@ static int __init bh1750_init(void)
         goto destroy_class;
     }
 
-    pr_info("BH1750 driver initialized. Major number: %d\n", major_num);
+    if (continuous) {
+        bh1750_fifo_device = device_create(bh1750_class, NULL, MKDEV(major_num, FIFO_MINOR),
+                                           NULL, DEV_NAME "_fifo");
+        if (IS_ERR(bh1750_fifo_device)) {
+            pr_err("Failed to create fifo device\n");
+            ret = PTR_ERR(bh1750_fifo_device);
+            goto destroy_device;
+        }
+    }
+
+    pr_info("BH1750 driver initialized. Major number: %d%s\n", major_num,
+            continuous ? " (continuous)" : "");
     return 0;
 
+destroy_device:
+    device_destroy(bh1750_class, MKDEV(major_num, 0));
 destroy_class:
     class_destroy(bh1750_class);
 unregister_chrdev:
     unregister_chrdev(major_num, DEV_NAME);
 unregister_client:
+    cancel_delayed_work_sync(&sample_work);
     i2c_unregister_device(i2c_client);
 put_adapter:
     i2c_put_adapter(i2c_adap);
@@ -132,6 +374,9 @@ put_adapter:
 
 static void __exit bh1750_exit(void)
 {
+    cancel_delayed_work_sync(&sample_work);
+    if (continuous)
+        device_destroy(bh1750_class, MKDEV(major_num, FIFO_MINOR));
     device_destroy(bh1750_class, MKDEV(major_num, 0));
     class_destroy(bh1750_class);
     unregister_chrdev(major_num, DEV_NAME);
@@ -5,18 +5,48 @@
 #include <linux/uaccess.h>
 #include <linux/mutex.h>
 #include <linux/device.h>
+#include <linux/ktime.h>
+#include <linux/kfifo.h>
+#include <linux/workqueue.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+
+#include "sensor_abi.h"
 
 #define DEV_NAME "mybmp"
 #define I2C_BUS_NUM    1
 #define BMP180_ADDR    0x77
+#define FIFO_MINOR     1 // /dev/mybmp_fifo
+#define FIFO_RECORDS   256
+
+/* oversampling 설정(0~3). ioctl(BMP180_IOC_SET_OSS)로 실행 중에도 바꿀 수 있다 */
+static unsigned int oss;
+module_param(oss, uint, 0444);
+MODULE_PARM_DESC(oss, "Initial pressure oversampling setting (0-3)");
+
+/* 0보다 크면 그 주기(ms)로 백그라운드 측정해 /dev/mybmp_fifo에 쌓는다 */
+static unsigned int sample_ms;
+module_param(sample_ms, uint, 0444);
+MODULE_PARM_DESC(sample_ms, "Background sampling period into the fifo device (ms, 0 = off)");
+
+/* OSS별 변환 대기 시간 (데이터시트 최대값 4.5/7.5/13.5/25.5ms 올림) */
+static const unsigned int oss_wait_ms[4] = { 5, 8, 14, 26 };
 
 static struct i2c_adapter *i2c_adap;
 static struct i2c_client *i2c_client;
 static int major_num;
 static struct class *bmp180_class;
 static struct device *bmp180_device;
+static struct device *bmp180_fifo_device;
 static DEFINE_MUTEX(bmp180_mutex);
 
+/* 백그라운드 샘플 기록 (생산자: sample_work, 소비자: fifo_read) */
+static DEFINE_KFIFO(sample_fifo, struct bmp180_record, FIFO_RECORDS);
+static DEFINE_MUTEX(fifo_read_mutex);
+static DECLARE_WAIT_QUEUE_HEAD(fifo_wq);
+static struct delayed_work sample_work;
+static u32 fifo_lost;
+
 /* 캘리브레이션 데이터 저장용 */
 static short AC1, AC2, AC3;
 static u16 AC4, AC5, AC6;
@@ -24,6 +54,7 @@ static short B1, B2, MB, MC, MD;
 
 /* 측정 결과 저장용 */
 static char result_msg[128] = "";
+static struct bmp180_sample last_sample;
 
 static short read_word(u8 reg)
 {
@@ -42,7 +73,7 @@ static short read_word(u8 reg)
     return (buf[0] << 8) | buf[1];
 }
 
-static long read_pressure_raw(void)
+static long read_pressure_raw(unsigned int cur_oss)
 {
     u8 reg = 0xF6;
     u8 buf[3];
@@ -57,47 +88,49 @@ static long read_pressure_raw(void)
         pr_err("Failed to read pressure\n");
         return -EIO;
     }
-    return (((long)buf[0] << 16) | ((long)buf[1] << 8) | buf[2]) >> (8 - 0);
+    return (((long)buf[0] << 16) | ((long)buf[1] << 8) | buf[2]) >> (8 - cur_oss);
 }
 
-static void measure_bmp180(void)
+/* bmp180_mutex를 잡은 상태에서 호출. 결과는 last_sample과 result_msg에 남는다 */
+static int measure_bmp180(void)
 {
+    unsigned int cur_oss = oss;
     u8 temp_cmd[2] = { 0xF4, 0x2E };
     if (i2c_master_send(i2c_client, temp_cmd, 2) != 2) {
         pr_err("Temp command failed\n");
-        return;
+        return -EIO;
     }
     msleep(5);
 
     short UT = read_word(0xF6);
-    if (UT < 0) return;
+    if (UT < 0) return -EIO;
 
     long X1 = ((UT - AC6) * AC5) >> 15;
     long X2 = (MC << 11) / (X1 + MD);
     long B5 = X1 + X2;
     int temperature = ((B5 + 8) >> 4);
 
-    u8 press_cmd[2] = { 0xF4, 0x34 };
+    u8 press_cmd[2] = { 0xF4, 0x34 + (cur_oss << 6) };
     if (i2c_master_send(i2c_client, press_cmd, 2) != 2) {
         pr_err("Pressure command failed\n");
-        return;
+        return -EIO;
     }
-    msleep(5);
+    msleep(oss_wait_ms[cur_oss]);
 
-    long UP = read_pressure_raw();
-    if (UP < 0) return;
+    long UP = read_pressure_raw(cur_oss);
+    if (UP < 0) return -EIO;
 
     long B6 = B5 - 4000;
     X1 = (B2 * ((B6 * B6) >> 12)) >> 11;
     X2 = (AC2 * B6) >> 11;
     long X3 = X1 + X2;
-    long B3 = (((((long)AC1) * 4 + X3) + 2) / 4);
+    long B3 = (((((long)AC1) * 4 + X3) << cur_oss) + 2) / 4;
 
     X1 = (AC3 * B6) >> 13;
     X2 = (B1 * ((B6 * B6) >> 12)) >> 16;
     X3 = ((X1 + X2) + 2) >> 2;
     u32 B4 = (AC4 * (u32)(X3 + 32768)) >> 15;
-    u32 B7 = ((u32)(UP - B3)) * 50000;
+    u32 B7 = ((u32)(UP - B3)) * (50000 >> cur_oss);
 
     long p;
     if (B7 < 0x80000000)
@@ -117,19 +150,130 @@ static void measure_bmp180(void)
         "Temperature: %d.%d C\nPressure: %ld.%02ld hPa\n",
         temperature / 10, temperature % 10,
         pressure_int, pressure_frac);
+
+    last_sample.temperature = temperature;
+    last_sample.pressure = p;
+    last_sample.timestamp_ns = ktime_get_ns();
+    last_sample.seq++;
+    last_sample.oss = cur_oss;
+    return 0;
 }
 
 static ssize_t dev_read(struct file *file, char __user *buf, size_t len, loff_t *offset)
 {
     ssize_t ret;
     mutex_lock(&bmp180_mutex);
-    measure_bmp180();
-    *offset = 0;
-    ret = simple_read_from_buffer(buf, len, offset, result_msg, strlen(result_msg));
+    ret = measure_bmp180();
+    if (ret == 0) {
+        *offset = 0;
+        ret = simple_read_from_buffer(buf, len, offset, result_msg, strlen(result_msg));
+    }
     mutex_unlock(&bmp180_mutex);
     return ret;
 }
 
+static long dev_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+    void __user *uarg = (void __user *)arg;
+    struct bmp180_sample sample;
+    __u32 val;
+    int ret;
+
+    switch (cmd) {
+    case BMP180_IOC_GET_SAMPLE:
+        mutex_lock(&bmp180_mutex);
+        ret = measure_bmp180();
+        sample = last_sample;
+        mutex_unlock(&bmp180_mutex);
+        if (ret < 0)
+            return ret;
+        if (copy_to_user(uarg, &sample, sizeof(sample)))
+            return -EFAULT;
+        return 0;
+    case BMP180_IOC_SET_OSS:
+        if (get_user(val, (__u32 __user *)uarg))
+            return -EFAULT;
+        if (val > 3)
+            return -EINVAL;
+        mutex_lock(&bmp180_mutex);
+        oss = val;
+        mutex_unlock(&bmp180_mutex);
+        return 0;
+    case BMP180_IOC_GET_OSS:
+        val = READ_ONCE(oss);
+        return put_user(val, (__u32 __user *)uarg);
+    default:
+        return -ENOTTY;
+    }
+}
+
+static void sample_work_fn(struct work_struct *work)
+{
+    struct bmp180_record rec;
+    int ret;
+
+    mutex_lock(&bmp180_mutex);
+    ret = measure_bmp180();
+    rec.timestamp_ns = last_sample.timestamp_ns;
+    rec.seq = last_sample.seq;
+    rec.temperature = last_sample.temperature;
+    rec.pressure = last_sample.pressure;
+    mutex_unlock(&bmp180_mutex);
+
+    if (ret == 0) {
+        rec.lost = fifo_lost;
+        if (kfifo_put(&sample_fifo, rec)) {
+            fifo_lost = 0;
+            wake_up_interruptible(&fifo_wq);
+        } else {
+            fifo_lost++; // 읽는 쪽이 밀림
+        }
+    }
+    schedule_delayed_work(&sample_work, msecs_to_jiffies(sample_ms));
+}
+
+/* 쌓인 레코드를 한 번에 최대한 꺼낸다 */
+static ssize_t fifo_read(struct file *file, char __user *buf, size_t len, loff_t *offset)
+{
+    unsigned int copied;
+    int ret;
+
+    if (len < sizeof(struct bmp180_record))
+        return -EINVAL;
+    len -= len % sizeof(struct bmp180_record);
+
+    if (kfifo_is_empty(&sample_fifo)) {
+        if (file->f_flags & O_NONBLOCK)
+            return -EAGAIN;
+        if (wait_event_interruptible(fifo_wq, !kfifo_is_empty(&sample_fifo)))
+            return -ERESTARTSYS;
+    }
+    mutex_lock(&fifo_read_mutex);
+    ret = kfifo_to_user(&sample_fifo, buf, len, &copied);
+    mutex_unlock(&fifo_read_mutex);
+    return ret ? ret : copied;
+}
+
+static __poll_t fifo_poll(struct file *file, poll_table *wait)
+{
+    poll_wait(file, &fifo_wq, wait);
+    return kfifo_is_empty(&sample_fifo) ? 0 : EPOLLIN | EPOLLRDNORM;
+}
+
+static ssize_t read_dispatch(struct file *file, char __user *buf, size_t len, loff_t *offset)
+{
+    if (iminor(file_inode(file)) == FIFO_MINOR)
+        return fifo_read(file, buf, len, offset);
+    return dev_read(file, buf, len, offset);
+}
+
+static __poll_t poll_dispatch(struct file *file, poll_table *wait)
+{
+    if (iminor(file_inode(file)) == FIFO_MINOR)
+        return fifo_poll(file, wait);
+    return EPOLLIN | EPOLLRDNORM;
+}
+
 static int dev_open(struct inode *inode, struct file *file)
 {
     return 0;
@@ -144,7 +288,9 @@ static struct file_operations fops = {
     .owner = THIS_MODULE,
     .open = dev_open,
     .release = dev_release,
-    .read = dev_read,
+    .read = read_dispatch,
+    .poll = poll_dispatch,
+    .unlocked_ioctl = dev_ioctl,
 };
 
 static int read_calibration_data(void)
@@ -175,6 +321,13 @@ static int __init bmp180_init(void)
     };
     int ret;
 
+    INIT_DELAYED_WORK(&sample_work, sample_work_fn);
+
+    if (oss > 3) {
+        pr_err("Invalid oss %u\n", oss);
+        return -EINVAL;
+    }
+
     i2c_adap = i2c_get_adapter(I2C_BUS_NUM);
     if (!i2c_adap) {
         pr_err("I2C adapter not found\n");
@@ -215,9 +368,22 @@ static int __init bmp180_init(void)
         goto destroy_class;
     }
 
+    if (sample_ms) {
+        bmp180_fifo_device = device_create(bmp180_class, NULL, MKDEV(major_num, FIFO_MINOR),
+                                           NULL, DEV_NAME "_fifo");
+        if (IS_ERR(bmp180_fifo_device)) {
+            pr_err("Failed to create fifo device\n");
+            ret = PTR_ERR(bmp180_fifo_device);
+            goto destroy_device;
+        }
+        schedule_delayed_work(&sample_work, 0);
+    }
+
     pr_info("BMP180 driver initialized. Major number: %d\n", major_num);
     return 0;
 
+destroy_device:
+    device_destroy(bmp180_class, MKDEV(major_num, 0));
 destroy_class:
     class_destroy(bmp180_class);
 unregister_chrdev:
@@ -231,6 +397,10 @@ put_adapter:
 
 static void __exit bmp180_exit(void)
 {
+    if (sample_ms) {
+        cancel_delayed_work_sync(&sample_work);
+        device_destroy(bmp180_class, MKDEV(major_num, FIFO_MINOR));
+    }
     device_destroy(bmp180_class, MKDEV(major_num, 0));
     class_destroy(bmp180_class);
     unregister_chrdev(major_num, DEV_NAME);
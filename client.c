@@ -8,24 +8,159 @@
 #include <arpa/inet.h>
 #include <pthread.h>
 #include <locale.h>
+#include <zlib.h>
+
+#include "wire_proto.h"
 
 #define BUF_SIZE 512
 
 int sockfd;
+int binary_mode = 0; // -b: 바이너리 프레임 프로토콜
+int deflate_mode = 0; // -z: 압축 스트림
+z_stream zs;
+// 바이너리 모드에서 푼 바이트는 다시 프레임이고, 원문이 나뉘면 프레임이 WIRE_DEFLATE 경계에 걸칠 수 있다
+unsigned char zbuf[WIRE_HDR_SIZE + WIRE_MAX_PAYLOAD + WIRE_DEFLATE_CHUNK];
+size_t zhave = 0;
+
+void print_frame(int type, const unsigned char *p, size_t len);
+
+/* 서버가 규약을 어겼다. 이어 읽어 봐야 프레임 경계를 믿을 수 없으므로 끝낸다 */
+void protocol_error(const char *what) {
+    printf("[클라이언트] 프로토콜 오류: %s\n", what);
+    exit(1);
+}
+
+/* WIRE_DEFLATE 하나를 풀어 출력한다. 프레임마다 사전을 새로 넣는다 */
+void print_deflated(const unsigned char *p, size_t len) {
+    unsigned char out[WIRE_DEFLATE_CHUNK];
+    inflateReset(&zs);
+    inflateSetDictionary(&zs, (const Bytef *)wire_deflate_dict, sizeof(wire_deflate_dict) - 1);
+    zs.next_in = (Bytef *)p;
+    zs.avail_in = len;
+    zs.next_out = out;
+    zs.avail_out = sizeof(out);
+    // 원문은 WIRE_DEFLATE_CHUNK를 넘지 않는다. 더 길거나 깨졌으면 오류
+    if (inflate(&zs, Z_FINISH) != Z_STREAM_END) protocol_error("압축 해제 실패");
+    size_t n = sizeof(out) - zs.avail_out;
+    if (!binary_mode) {
+        fwrite(out, 1, n, stdout);
+        return;
+    }
+    // 덜 온 프레임(최대 WIRE_HDR_SIZE + WIRE_MAX_PAYLOAD)과 새 조각은 항상 들어간다
+    if (n > sizeof(zbuf) - zhave) protocol_error("압축 프레임이 너무 깁니다");
+    memcpy(zbuf + zhave, out, n);
+    size_t end = zhave + n, pos = 0;
+    while (end - pos >= WIRE_HDR_SIZE) {
+        size_t flen = wire_get16(zbuf + pos + 1);
+        if (end - pos < WIRE_HDR_SIZE + flen) break;
+        if (zbuf[pos] != WIRE_DEFLATE) print_frame(zbuf[pos], zbuf + pos + WIRE_HDR_SIZE, flen);
+        pos += WIRE_HDR_SIZE + flen;
+    }
+    memmove(zbuf, zbuf + pos, end - pos);
+    zhave = end - pos;
+}
+
+void print_frame(int type, const unsigned char *p, size_t len) {
+    switch (type) {
+    case WIRE_HELLO:
+        if (len >= 2 && (p[1] & WIRE_HELLO_DEFLATE))
+            printf("[클라이언트] 압축 스트림 사용\n");
+        else
+            printf("[클라이언트] 바이너리 프로토콜 v%d\n", len ? p[0] : 0);
+        break;
+    case WIRE_TEXT:
+        printf("%.*s\n", (int)len, p);
+        break;
+    case WIRE_CHAT:
+    case WIRE_NOTICE: {
+        size_t nl = len ? p[0] : 0;
+        if (len < nl + 1) break;
+        const char *name = (const char *)p + 1, *text = name + nl;
+        int tl = len - nl - 1;
+        if (type == WIRE_CHAT)
+            printf("%.*s: %.*s\n", (int)nl, name, tl, text);
+        else if (nl)
+            printf("[공지:%.*s] %.*s\n", (int)nl, name, tl, text);
+        else
+            printf("[공지] %.*s\n", tl, text);
+        break;
+    }
+    case WIRE_SAMPLE: {
+        if (len < WIRE_SAMPLE_SIZE) break;
+        unsigned long long ts = wire_get64(p);
+        printf("[센서 %llu.%03llu]", ts / 1000, ts % 1000);
+        if (p[9] == 0)
+            printf(" 온도 %.1f°C, 기압 %.2f hPa", (int16_t)wire_get16(p + 11) / 10.0, wire_get32(p + 13) / 100.0);
+        else
+            printf(" 온도 센서 오류(%d)", p[9]);
+        if (p[10] == 0)
+            printf(", 조도 %u lux\n", wire_get32(p + 17));
+        else
+            printf(", 조도 센서 오류(%d)\n", p[10]);
+        break;
+    }
+    case WIRE_FORECAST: {
+        if (len < 13) break;
+        printf("[예보 %.8s %.4s 발표]\n", p, p + 8);
+        for (int i = 0; i < p[12] && 13 + (i + 1) * WIRE_FORECAST_ENTRY_SIZE <= (int)len; i++) {
+            const unsigned char *e = p + 13 + i * WIRE_FORECAST_ENTRY_SIZE;
+            printf("  %04u 기온 %.1f°C 하늘 %d 강수형태 %d 강수량 %.1fmm 습도 %d%% 풍속 %.1fm/s\n",
+                   wire_get16(e), (int16_t)wire_get16(e + 2) / 10.0, e[4], e[5],
+                   wire_get16(e + 6) / 10.0, e[8], wire_get16(e + 9) / 10.0);
+        }
+        break;
+    }
+    case WIRE_DEFLATE:
+        print_deflated(p, len);
+        break;
+    }
+}
 
 void *recv_thread(void *arg) {
-    char buf[BUF_SIZE];
+    static unsigned char buf[WIRE_HDR_SIZE + WIRE_MAX_PAYLOAD + BUF_SIZE];
+    size_t have = 0;
+    int framed = 0; // 협상 응답(첫 NUL 바이트) 이후로는 프레임
+    int framing = binary_mode || deflate_mode;
     int bytes_recv;
 
+    (void)arg;
+
     while (1) {
-        memset(buf, 0, sizeof(buf));
-        bytes_recv = recv(sockfd, buf, sizeof(buf) - 1, 0);
+        bytes_recv = recv(sockfd, buf + have, framing ? sizeof(buf) - have : BUF_SIZE - 1, 0);
         if (bytes_recv <= 0) {
             printf("[서버 연결 종료]\n");
             exit(0);
         }
-        buf[bytes_recv] = '\0';
-        printf("%s", buf);
+        if (!framing) {
+            buf[bytes_recv] = '\0';
+            printf("%s", buf);
+            fflush(stdout);
+            continue;
+        }
+
+        size_t end = have + bytes_recv, pos = have;
+        if (!framed) {
+            unsigned char *nul = memchr(buf + have, '\0', bytes_recv);
+            size_t text_end = nul ? (size_t)(nul - buf) : end;
+            fwrite(buf + have, 1, text_end - have, stdout);
+            if (!nul) {
+                fflush(stdout);
+                continue;
+            }
+            framed = 1;
+            pos = text_end;
+        } else {
+            pos = 0;
+        }
+        // 완성된 프레임만 처리하고 남은 조각은 앞으로 당긴다
+        while (end - pos >= WIRE_HDR_SIZE) {
+            size_t len = wire_get16(buf + pos + 1);
+            if (end - pos < WIRE_HDR_SIZE + len) break;
+            print_frame(buf[pos], buf + pos + WIRE_HDR_SIZE, len);
+            pos += WIRE_HDR_SIZE + len;
+        }
+        memmove(buf, buf + pos, end - pos);
+        have = end - pos;
         fflush(stdout);
     }
     return NULL;
@@ -38,8 +173,18 @@ int main(int argc, char *argv[]) {
     pthread_t tid;
     char buf[BUF_SIZE];
 
-    if (argc != 2) {
-        fprintf(stderr, "사용법: %s <서버 IP>\n", argv[0]);
+    int argi = 1;
+    for (; argi < argc - 1; argi++) {
+        if (strcmp(argv[argi], "-b") == 0) binary_mode = 1;
+        else if (strcmp(argv[argi], "-z") == 0) deflate_mode = 1;
+        else break;
+    }
+    if (argi != argc - 1) {
+        fprintf(stderr, "사용법: %s [-b] [-z] <서버 IP>\n", argv[0]);
+        exit(1);
+    }
+    if (deflate_mode && inflateInit2(&zs, -15) != Z_OK) {
+        fprintf(stderr, "inflateInit2() error\n");
         exit(1);
     }
 
@@ -52,7 +197,7 @@ int main(int argc, char *argv[]) {
     // 서버 주소 설정
     server_addr.sin_family = AF_INET;
     server_addr.sin_port = htons(10000);
-    server_addr.sin_addr.s_addr = inet_addr(argv[1]);
+    server_addr.sin_addr.s_addr = inet_addr(argv[argi]);
     memset(&(server_addr.sin_zero), '\0', 8);
 
     // 서버 연결
@@ -63,6 +208,16 @@ int main(int argc, char *argv[]) {
 
     printf("[클라이언트] 서버에 연결되었습니다. 채팅을 시작하세요!\n");
 
+    // 닉네임보다 먼저 보내야 서버가 바이너리 프레임으로 전환한다
+    if (binary_mode && send(sockfd, WIRE_HELLO_LINE, strlen(WIRE_HELLO_LINE), 0) == -1) {
+        perror("send() error");
+        exit(1);
+    }
+    if (deflate_mode && send(sockfd, WIRE_DEFLATE_LINE, strlen(WIRE_DEFLATE_LINE), 0) == -1) {
+        perror("send() error");
+        exit(1);
+    }
+
     // 메시지 수신 스레드 시작
     pthread_create(&tid, NULL, recv_thread, NULL);
     pthread_detach(tid);
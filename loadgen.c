@@ -0,0 +1,456 @@
+/*
+ * 부하 생성기: client.c처럼 접속해 닉네임을 보내고, 채팅과 /temp /lux /weather를
+ * 정해진 속도로 보내며 처리량과 지연(p50/p99/p999)을 잰다.
+ *
+ * 오프라인으로 돌리려면 가짜 센서 파일과 가짜 기상청 서버를 함께 띄운다:
+ *   ./loadgen --fake-kma 18080 --sensor-dir /tmp/wx -c 200 -r 2000 -d 10 &
+ *   ./server --kma-url http://127.0.0.1:18080/ --bmp-dev /tmp/wx/mybmp --bh-dev /tmp/wx/mybh
+ * loadgen은 서버가 뜰 때까지 접속을 다시 시도한다.
+ *
+ * 지연 측정:
+ *   명령 - 보낸 시각을 연결별 FIFO에 넣고 응답 줄이 오면 꺼낸다 (서버는 순서대로 답한다)
+ *   방송 - 채팅 본문에 "LG <연결> <번호> <보낸 시각ns>"를 싣고 받은 쪽마다 차이를 잰다
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <locale.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define BUF_SIZE 4096
+#define PENDING_MAX 256 // 연결당 답을 기다리는 명령 수 상한
+#define MAX_EVENTS 256
+
+enum action { ACT_CHAT, ACT_TEMP, ACT_LUX, ACT_WEATHER, ACT_COUNT };
+const char *action_names[ACT_COUNT] = { "chat", "temp", "lux", "weather" };
+const char *action_cmds[ACT_COUNT] = { NULL, "/temp\n", "/lux\n", "/weather\n" };
+
+typedef struct {
+    int fd;
+    int id;
+    int ready; // 환영 메시지를 받음
+    uint64_t joined; // 환영 메시지를 받은 시각. 이보다 먼저 보낸 방송은 입장 백로그로 다시 온 것
+    char inbuf[BUF_SIZE];
+    size_t inlen;
+    uint64_t next_send;
+    uint64_t pending[PENDING_MAX];
+    int p_head, p_count;
+    unsigned seq;
+} conn;
+
+/* 지연 표본. 끝에 정렬해서 백분위를 뽑는다 */
+typedef struct {
+    uint64_t *v;
+    size_t n, cap;
+} lat_vec;
+
+const char *host = "127.0.0.1";
+int port = 10000;
+int n_conns = 100;
+double rate = 1000;   // 전체 초당 전송 수
+int duration = 10;
+int weights[ACT_COUNT] = { 50, 20, 20, 10 };
+int fake_kma_port = 0;
+const char *sensor_dir = NULL;
+
+conn *conns;
+lat_vec cmd_lat, bcast_lat;
+unsigned long sent[ACT_COUNT], recv_lines, notices, skipped, errors;
+volatile sig_atomic_t running = 1;
+
+uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void lat_add(lat_vec *l, uint64_t v) {
+    if (l->n == l->cap) {
+        size_t ncap = l->cap ? l->cap * 2 : 4096;
+        uint64_t *nv = realloc(l->v, ncap * sizeof(uint64_t));
+        if (!nv) return;
+        l->v = nv;
+        l->cap = ncap;
+    }
+    l->v[l->n++] = v;
+}
+
+int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+void lat_report(const char *name, lat_vec *l) {
+    if (l->n == 0) {
+        printf("%-10s 표본 없음\n", name);
+        return;
+    }
+    qsort(l->v, l->n, sizeof(uint64_t), cmp_u64);
+#define PCT(p) (l->v[(size_t)((l->n - 1) * (p))] / 1000.0)
+    printf("%-10s n=%-9zu p50 %8.1fus  p99 %8.1fus  p999 %8.1fus  max %8.1fus\n",
+           name, l->n, PCT(0.5), PCT(0.99), PCT(0.999), l->v[l->n - 1] / 1000.0);
+#undef PCT
+}
+
+/* ---- 가짜 기상청 (getUltraSrtFcst) ---- */
+
+/* 요청의 base_date/base_time으로 6시간치 예보를 만들어 돌려준다 */
+void fake_kma_reply(int fd, const char *req) {
+    char date[9] = "20250101", btime[5] = "0030";
+    const char *p;
+    if ((p = strstr(req, "base_date="))) sscanf(p + 10, "%8[0-9]", date);
+    if ((p = strstr(req, "base_time="))) sscanf(p + 10, "%4[0-9]", btime);
+    static const char *cats[] = { "T1H", "RN1", "SKY", "UUU", "VVV", "REH", "PTY", "LGT", "VEC", "WSD" };
+    static const char *vals[] = { "21.5", "강수없음", "3", "0.4", "-1.2", "60", "0", "0", "230", "1.8" };
+
+    char body[16384];
+    int len = snprintf(body, sizeof(body),
+        "{\"response\":{\"header\":{\"resultCode\":\"00\",\"resultMsg\":\"NORMAL_SERVICE\"},"
+        "\"body\":{\"dataType\":\"JSON\",\"items\":{\"item\":[");
+    int h = atoi(btime) / 100;
+    for (int c = 0; c < 10; c++) {
+        for (int k = 1; k <= 6; k++) {
+            len += snprintf(body + len, sizeof(body) - len,
+                "%s{\"baseDate\":\"%s\",\"baseTime\":\"%s\",\"category\":\"%s\",\"fcstDate\":\"%s\","
+                "\"fcstTime\":\"%02d00\",\"fcstValue\":\"%s\",\"nx\":58,\"ny\":125}",
+                (c || k > 1) ? "," : "", date, btime, cats[c], date, (h + k) % 24, vals[c]);
+        }
+    }
+    len += snprintf(body + len, sizeof(body) - len, "]},\"pageNo\":1,\"numOfRows\":60,\"totalCount\":60}}}");
+
+    char hdr[256];
+    int hl = snprintf(hdr, sizeof(hdr),
+        "HTTP/1.1 200 OK\r\nContent-Type: application/json;charset=UTF-8\r\n"
+        "Content-Length: %d\r\nConnection: close\r\n\r\n", len);
+    if (write(fd, hdr, hl) < 0 || write(fd, body, len) < 0) return;
+}
+
+void *fake_kma_thread(void *arg) {
+    int lfd = (int)(intptr_t)arg;
+    while (running) {
+        int fd = accept(lfd, NULL, NULL);
+        if (fd < 0) continue;
+        char req[4096];
+        size_t have = 0;
+        ssize_t n;
+        while (have < sizeof(req) - 1 && (n = read(fd, req + have, sizeof(req) - 1 - have)) > 0) {
+            have += n;
+            req[have] = '\0';
+            if (strstr(req, "\r\n\r\n")) break;
+        }
+        req[have] = '\0';
+        fake_kma_reply(fd, req);
+        close(fd);
+    }
+    return NULL;
+}
+
+int start_fake_kma(int kport) {
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(kport) };
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int lfd = socket(AF_INET, SOCK_STREAM, 0), on = 1;
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(lfd, 16) == -1) {
+        perror("가짜 기상청 서버");
+        return -1;
+    }
+    pthread_t tid;
+    pthread_create(&tid, NULL, fake_kma_thread, (void *)(intptr_t)lfd);
+    pthread_detach(tid);
+    return 0;
+}
+
+/* ---- 가짜 센서: 드라이버와 같은 텍스트 형식의 파일을 주기적으로 고쳐 쓴다 ---- */
+
+void *fake_sensor_thread(void *arg) {
+    (void)arg;
+    char bmp_path[512], bh_path[512];
+    snprintf(bmp_path, sizeof(bmp_path), "%s/mybmp", sensor_dir);
+    snprintf(bh_path, sizeof(bh_path), "%s/mybh", sensor_dir);
+    // 서버가 fd를 열어 둔 채 다시 읽으므로 같은 inode에 고정 폭으로 덮어쓴다
+    int fd_bmp = open(bmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int fd_bh = open(bh_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd_bmp < 0 || fd_bh < 0) {
+        perror("가짜 센서 파일");
+        return NULL;
+    }
+    for (unsigned i = 0; running; i++) {
+        char buf[128];
+        double temp = 24 + 4 * ((i % 600) / 600.0);
+        int len = snprintf(buf, sizeof(buf), "Temperature: %5.1f C\nPressure: %7.2f hPa\n", temp, 1013.25 - (i % 100) * 0.01);
+        if (pwrite(fd_bmp, buf, len, 0) < 0) break;
+        len = snprintf(buf, sizeof(buf), "%5d lux\n", (int)(i * 37 % 2000));
+        if (pwrite(fd_bh, buf, len, 0) < 0) break;
+        usleep(100000);
+    }
+    close(fd_bmp);
+    close(fd_bh);
+    return NULL;
+}
+
+/* ---- 부하 ---- */
+
+int conn_open(conn *c) {
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port) };
+    addr.sin_addr.s_addr = inet_addr(host);
+    c->fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (c->fd < 0) return -1;
+    if (connect(c->fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        close(c->fd);
+        c->fd = -1;
+        return -1;
+    }
+    int on = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL) | O_NONBLOCK);
+    char nick[32];
+    int len = snprintf(nick, sizeof(nick), "lg%d\n", c->id);
+    return send(c->fd, nick, len, MSG_NOSIGNAL) == len ? 0 : -1;
+}
+
+void conn_line(conn *c, char *line, uint64_t now) {
+    char *p;
+    recv_lines++;
+    if (!c->ready) {
+        if (strstr(line, "[알림]")) { // 닉네임 안내문 뒤에 바로 붙어 온다
+            c->ready = 1;
+            c->joined = now;
+        }
+        return;
+    }
+    if ((p = strstr(line, "LG "))) {
+        int from;
+        unsigned seq;
+        unsigned long long t;
+        // 입장 전에 보낸 줄은 백로그 재전송이라 지연이 아니다
+        if (sscanf(p, "LG %d %u %llu", &from, &seq, &t) == 3 && t >= c->joined && now >= t) lat_add(&bcast_lat, now - t);
+        return;
+    }
+    if (strstr(line, "[공지]") || strstr(line, "[구독]")) {
+        notices++;
+        return;
+    }
+    if (c->p_count > 0) {
+        lat_add(&cmd_lat, now - c->pending[c->p_head]);
+        c->p_head = (c->p_head + 1) % PENDING_MAX;
+        c->p_count--;
+    }
+}
+
+void conn_read(conn *c) {
+    for (;;) {
+        ssize_t n = recv(c->fd, c->inbuf + c->inlen, sizeof(c->inbuf) - 1 - c->inlen, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (n <= 0) {
+            errors++;
+            close(c->fd);
+            c->fd = -1;
+            return;
+        }
+        uint64_t now = now_ns();
+        c->inlen += n;
+        size_t start = 0;
+        char *nl;
+        while ((nl = memchr(c->inbuf + start, '\n', c->inlen - start))) {
+            *nl = '\0';
+            conn_line(c, c->inbuf + start, now);
+            start = nl - c->inbuf + 1;
+        }
+        if (start == 0 && c->inlen == sizeof(c->inbuf) - 1) start = c->inlen; // 줄바꿈 없는 긴 줄은 버림
+        memmove(c->inbuf, c->inbuf + start, c->inlen - start);
+        c->inlen -= start;
+    }
+}
+
+void conn_send(conn *c, uint64_t now) {
+    int total = 0, pick;
+    for (int a = 0; a < ACT_COUNT; a++) total += weights[a];
+    pick = rand() % total;
+    int a;
+    for (a = 0; a < ACT_COUNT - 1 && pick >= weights[a]; a++) pick -= weights[a];
+
+    char msg[128];
+    int len;
+    if (a == ACT_CHAT) {
+        len = snprintf(msg, sizeof(msg), "LG %d %u %llu\n", c->id, c->seq++, (unsigned long long)now);
+    } else {
+        if (c->p_count == PENDING_MAX) {
+            skipped++;
+            return;
+        }
+        len = snprintf(msg, sizeof(msg), "%s", action_cmds[a]);
+    }
+    ssize_t n = send(c->fd, msg, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n != len) {
+        // 서버가 못 받아 가는 중: 보낸 것으로 치지 않는다 (일부만 나간 줄은 드물어 무시)
+        skipped++;
+        return;
+    }
+    if (a != ACT_CHAT) {
+        c->pending[(c->p_head + c->p_count++) % PENDING_MAX] = now;
+    }
+    sent[a]++;
+}
+
+void sigint_handler(int sig) {
+    (void)sig;
+    running = 0;
+}
+
+void usage(const char *prog) {
+    fprintf(stderr, "사용법: %s [-H 호스트] [-p 포트] [-c 연결수] [-r 초당전송] [-d 초] "
+                    "[-m chat,temp,lux,weather 비율] [--fake-kma 포트] [--sensor-dir DIR]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    setlocale(LC_ALL, "");
+
+    static const struct option long_opts[] = {
+        { "fake-kma", required_argument, NULL, 'K' },
+        { "sensor-dir", required_argument, NULL, 'S' },
+        { NULL, 0, NULL, 0 }
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "H:p:c:r:d:m:", long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 'H': host = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 'c': n_conns = atoi(optarg); break;
+        case 'r': rate = atof(optarg); break;
+        case 'd': duration = atoi(optarg); break;
+        case 'm':
+            if (sscanf(optarg, "%d,%d,%d,%d", &weights[0], &weights[1], &weights[2], &weights[3]) != 4)
+                usage(argv[0]);
+            break;
+        case 'K': fake_kma_port = atoi(optarg); break;
+        case 'S': sensor_dir = optarg; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (n_conns <= 0 || rate <= 0 || duration <= 0 ||
+        weights[0] + weights[1] + weights[2] + weights[3] <= 0) usage(argv[0]);
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, sigint_handler);
+    srand(time(NULL));
+
+    // 연결 수만큼 fd가 필요하다 (-c 10000 등)
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    if (fake_kma_port && start_fake_kma(fake_kma_port) < 0) exit(1);
+    if (sensor_dir) {
+        pthread_t tid;
+        mkdir(sensor_dir, 0755);
+        pthread_create(&tid, NULL, fake_sensor_thread, NULL);
+        pthread_detach(tid);
+    }
+
+    conns = calloc(n_conns, sizeof(conn));
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (!conns || epfd < 0) {
+        perror("초기화 실패");
+        exit(1);
+    }
+
+    // 서버가 늦게 떠도 되도록 10초 동안 재시도
+    uint64_t deadline = now_ns() + 10000000000ULL;
+    for (int i = 0; i < n_conns && running; i++) {
+        conns[i].id = i;
+        while (conn_open(&conns[i]) < 0) {
+            if (now_ns() > deadline || !running) {
+                fprintf(stderr, "[loadgen] %s:%d 접속 실패 (%d/%d)\n", host, port, i, n_conns);
+                exit(1);
+            }
+            usleep(100000);
+        }
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &conns[i] };
+        epoll_ctl(epfd, EPOLL_CTL_ADD, conns[i].fd, &ev);
+    }
+
+    // 모든 연결이 환영 메시지를 받을 때까지 기다린다
+    struct epoll_event events[MAX_EVENTS];
+    int ready = 0;
+    deadline = now_ns() + 10000000000ULL;
+    while (running && ready < n_conns && now_ns() < deadline) {
+        int n = epoll_wait(epfd, events, MAX_EVENTS, 100);
+        for (int i = 0; i < n; i++) {
+            conn *c = events[i].data.ptr;
+            int was = c->ready;
+            conn_read(c);
+            if (!was && c->ready) ready++;
+        }
+    }
+    printf("[loadgen] 연결 %d/%d 준비, 초당 %.0f건으로 %d초 동안 전송\n", ready, n_conns, rate, duration);
+    recv_lines = 0;
+
+    // 연결마다 같은 속도로, 시작 시각만 흩어서 보낸다
+    uint64_t interval = (uint64_t)(1e9 * n_conns / rate), start = now_ns();
+    for (int i = 0; i < n_conns; i++) conns[i].next_send = start + interval * i / n_conns;
+    uint64_t end = start + (uint64_t)duration * 1000000000ULL;
+
+    while (running) {
+        uint64_t now = now_ns();
+        if (now >= end) break;
+        for (int i = 0; i < n_conns; i++) {
+            conn *c = &conns[i];
+            if (c->fd < 0 || !c->ready) continue;
+            while (c->next_send <= now) {
+                conn_send(c, now);
+                c->next_send += interval;
+            }
+        }
+        int n = epoll_wait(epfd, events, MAX_EVENTS, 1);
+        for (int i = 0; i < n; i++) {
+            conn *c = events[i].data.ptr;
+            if (c->fd >= 0) conn_read(c);
+        }
+    }
+    // 남은 응답을 잠깐 더 받는다
+    uint64_t drain = now_ns() + 500000000ULL;
+    while (now_ns() < drain) {
+        int n = epoll_wait(epfd, events, MAX_EVENTS, 50);
+        for (int i = 0; i < n; i++) {
+            conn *c = events[i].data.ptr;
+            if (c->fd >= 0) conn_read(c);
+        }
+    }
+    double secs = (now_ns() - start) / 1e9;
+
+    unsigned long total_sent = 0;
+    for (int a = 0; a < ACT_COUNT; a++) total_sent += sent[a];
+    printf("[loadgen] %.1f초, 보냄 %lu건 (%.0f/s):", secs, total_sent, total_sent / secs);
+    for (int a = 0; a < ACT_COUNT; a++) printf(" %s %lu", action_names[a], sent[a]);
+    printf("\n[loadgen] 받은 줄 %lu (%.0f/s), 공지 %lu, 건너뜀 %lu, 끊김 %lu\n",
+           recv_lines, recv_lines / secs, notices, skipped, errors);
+    lat_report("명령", &cmd_lat);
+    lat_report("방송", &bcast_lat);
+
+    for (int i = 0; i < n_conns; i++)
+        if (conns[i].fd >= 0) close(conns[i].fd);
+    free(conns);
+    free(cmd_lat.v);
+    free(bcast_lat.v);
+    return 0;
+}
@@ -0,0 +1,48 @@
+#ifndef SENSOR_ABI_H
+#define SENSOR_ABI_H
+
+/* /dev/mybmp, /dev/mybh 드라이버와 사용자 공간(server.c)이 공유하는 바이너리 ABI */
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/* BMP180 측정 결과 한 건 (고정소수점, 텍스트 변환 없음) */
+struct bmp180_sample {
+    __s32 temperature;   /* 0.1 °C 단위 */
+    __u32 pressure;      /* Pa */
+    __u64 timestamp_ns;  /* 측정 시각, CLOCK_MONOTONIC */
+    __u32 seq;           /* 측정할 때마다 1씩 증가 */
+    __u8  oss;           /* 측정에 쓴 oversampling 설정 (0~3) */
+    __u8  pad[3];
+};
+
+#define BMP180_IOC_MAGIC    'b'
+/* 새로 측정해 결과를 돌려준다 */
+#define BMP180_IOC_GET_SAMPLE _IOR(BMP180_IOC_MAGIC, 1, struct bmp180_sample)
+/* oversampling 설정: 0(4.5ms) 1(7.5ms) 2(13.5ms) 3(25.5ms), 클수록 잡음이 적다 */
+#define BMP180_IOC_SET_OSS    _IOW(BMP180_IOC_MAGIC, 2, __u32)
+#define BMP180_IOC_GET_OSS    _IOR(BMP180_IOC_MAGIC, 3, __u32)
+
+/*
+ * 커널 타이머(delayed_work)로 샘플링한 기록을 쌓아 두는 kfifo 장치.
+ * /dev/mybmp_fifo, /dev/mybh_fifo 에서 read() 한 번에 레코드 여러 개를 꺼낸다.
+ * 읽기 크기는 레코드 크기의 배수여야 하며, 비어 있으면 블록(O_NONBLOCK이면 EAGAIN).
+ * fifo가 가득 차서 버린 샘플 수는 다음으로 들어가는 레코드의 lost에 실린다.
+ */
+struct bmp180_record {
+    __u64 timestamp_ns;  /* CLOCK_MONOTONIC */
+    __u32 seq;
+    __s32 temperature;   /* 0.1 °C 단위 */
+    __u32 pressure;      /* Pa */
+    __u32 lost;          /* 이 레코드 직전에 넘쳐서 버려진 샘플 수 */
+};
+
+struct bh1750_record {
+    __u64 timestamp_ns;  /* CLOCK_MONOTONIC */
+    __u32 seq;
+    __u32 lux;
+    __u32 lost;          /* 이 레코드 직전에 넘쳐서 버려진 샘플 수 */
+    __u32 pad;
+};
+
+#endif
@@ -1,5 +1,8 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
+#include <stdatomic.h>
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
@@ -7,16 +10,38 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
 #include <pthread.h>
 #include <locale.h>
 #include <fcntl.h>
-#include <sys/select.h>
+#include <getopt.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/random.h>
+#include <dirent.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stddef.h>
 #include <time.h>
+#include <math.h>
 #include <curl/curl.h>
+#include <zlib.h>
 
-#define MAX_CLIENTS 100
+#include "sensor_abi.h"
+#include "wire_proto.h"
+
+#define MAX_CLIENTS 65536
+#define MAX_EVENTS 256
 #define BUF_SIZE 4096
 #define NICK_SIZE 32
+#define OUTQ_MAX_MSGS 64                 // 연결당 송신 대기 메시지 수 상한
+#define OUTQ_DEFAULT_BYTES (256 * 1024)  // 연결당 송신 대기 바이트 기본 상한
 
 #define COLOR_RESET    "\033[0m"
 #define COLOR_YELLOW   "\033[33m"
@@ -27,38 +52,568 @@
 
 #define KMA_NX "58"
 #define KMA_NY "125"
+#define KMA_PUBLISH_DELAY 600   // base_time 이후 API에 반영될 때까지 기다리는 시간(초)
+#define KMA_RETRY_MIN 5
+#define KMA_RETRY_MAX 300
+#define KMA_TIMEOUT_MS 5000
+#define SAMPLE_DEFAULT_MS 1000 // 센서 샘플링 기본 주기
+#define SENSOR_SLEEP_SLICE_MS 200 // 긴 대기도 이 간격으로 server_running을 확인한다
+#define FCST_MAX_TIMES 6   // 초단기예보는 6시간치
+#define FCST_MAX_GRIDS 4
+#define HIST_RAW_SAMPLES 3600 // 원본 샘플 링 크기
+#define HIST_WIN_MAX 60        // 조회 창에 들어가는 버킷 수 상한
+#define SUB_MAX_BUCKETS 16     // 서로 다른 구독 주기 수
+#define SUB_MAX_INTERVAL_MS 3600000
+#define HTTP_MAX_IDLE_HANDLES 8 // 재사용을 위해 보관하는 easy 핸들 수
 #define KMA_SERVICE_KEY "IayxGddnnCOfOV1nAMov7RRISsZrbItoovEHU3zrGw3wV2mWJrLMbbfoKzv4Jn4DZifO6GleJgcFm%2FK%2Bu6fUWg%3D%3D" // 반드시 본인 키로 교체
 
+/* epoll에 등록되는 모든 fd의 공통 헤더 (epoll_event.data.ptr가 가리킴) */
+typedef struct io_handler {
+    void (*on_event)(struct io_handler *h, uint32_t events);
+} io_handler;
+
+/* 연결별 상태: 닉네임 입력 대기 -> 채팅 */
+enum client_state {
+    CLIENT_NICK,
+    CLIENT_CHAT,
+};
+
+/* 송신 큐 메시지 종류. 센서 공지는 느린 클라이언트에게 최신 것만 남길 수 있다 */
+enum msg_kind {
+    MSG_TEXT,
+    MSG_SENSOR,
+    MSG_STREAM, // 구독 갱신: 아직 안 나간 같은 신호의 갱신을 덮어쓴다
+};
+
+/* 센서 신호 (이력, 저장소, 규칙, 구독이 같은 번호를 쓴다) */
+enum hist_metric { HIST_TEMP, HIST_PRESSURE, HIST_LUX, HIST_COUNT };
+const char *hist_metric_names[HIST_COUNT] = { "temp", "pressure", "lux" };
+
+/* 송신 큐가 상한을 넘은 느린 클라이언트 처리 방식 */
+enum slow_policy {
+    SLOW_DROP,       // 새 메시지를 버림
+    SLOW_LATEST,     // 밀린 메시지를 버리고 최신 센서 공지만 남김
+    SLOW_DISCONNECT, // 연결 종료
+};
+
+/* 한 번만 렌더링해 모든 수신자의 큐가 공유하는 불변 메시지 버퍼 */
+typedef struct msgbuf {
+    atomic_int refs;
+    _Atomic(struct msgbuf *) deflated; // 압축 연결용 WIRE_DEFLATE 판. 처음 필요할 때 만든다
+    size_t len;
+    char data[];
+} msgbuf;
+
+typedef struct {
+    msgbuf *buf;
+    enum msg_kind kind;
+    unsigned char topic; // MSG_STREAM의 신호
+} out_msg;
+
+struct sub_bucket;
+
+/* 클라이언트 핸들: 세대(32) | 샤드(16) | 슬롯(16). 0은 "없음" */
+typedef uint64_t client_handle;
+#define HANDLE_SHARD(h) ((int)((h) >> 16 & 0xffff))
+
 typedef struct {
+    io_handler io; // 반드시 첫 멤버
     int sockfd;
+    client_handle id;
+    int pos;           // 샤드의 clients[] 안 위치
+    enum client_state state;
     char nickname[NICK_SIZE];
+    // 송신 큐 (원형 버퍼, 소유 워커만 접근). EPOLLOUT 시 writev로 한 번에 비운다
+    out_msg outq[OUTQ_MAX_MSGS];
+    int outq_head;
+    int outq_count;
+    size_t outq_off;   // head 메시지 중 이미 보낸 바이트
+    size_t outq_bytes; // 큐에 남은 전체 바이트
+    int closing;       // 종료 예약됨 (더 이상 큐에 넣지 않음)
+    int binary;        // 바이너리 프레임 프로토콜 협상됨 (wire_proto.h)
+    int deflate;       // WIRE_DEFLATE로 감싸서 보냄 (wire_proto.h)
+    int admin;         // 루프백 접속: /stats 같은 운영 명령 허용
+    int corked;        // 읽기 묶음 처리 중: 응답을 모았다가 끝에 한 번에 보낸다
+    int pool_pending;  // 작업 풀 응답 대기 중: 응답 순서를 지키려고 뒤 명령은 읽지도 처리하지도 않는다
+    // 수신 버퍼. 완성된 줄만 꺼내 처리하고 남은 조각은 다음 recv와 잇는다
+    char inbuf[BUF_SIZE];
+    size_t inlen;
+    unsigned stream_queued;            // 큐에 대기 중인 MSG_STREAM 신호 비트
+    struct sub_bucket *sub[HIST_COUNT]; // 구독 중인 주기 묶음
+    int sub_pos[HIST_COUNT];
 } client_info;
 
-client_info clients[MAX_CLIENTS];
-int client_count = 0;
-pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+/* 같은 주기의 구독자 묶음. 샘플 하나를 렌더링해 묶음 전체에 한 번에 뿌린다 */
+typedef struct sub_bucket {
+    int interval_ms;
+    long long due_ms; // CLOCK_MONOTONIC
+    client_info **subs[HIST_COUNT];
+    int n[HIST_COUNT], cap[HIST_COUNT];
+} sub_bucket;
+
+/* 다른 스레드가 샤드에 보내는 방송 한 건. 받는 샤드가 자기 클라이언트에게 뿌린다 */
+typedef struct shard_msg {
+    _Atomic(struct shard_msg *) next;
+    msgbuf *text, *bin;   // 텍스트/바이너리 클라이언트용 (bin이 NULL이면 바이너리는 건너뜀)
+    enum msg_kind kind;
+    client_handle exclude; // 보낸 사람 (0이면 없음)
+    client_handle target;  // 0이 아니면 이 연결에만 (풀 작업 완료)
+    uint64_t posted_ns;
+    char user[NICK_SIZE]; // 비어 있지 않으면 이 닉네임에게만
+} shard_msg;
+
+/* 침입형 MPSC 큐 (Vyukov). 생산자는 head 교체 한 번, 소비자는 락 없이 tail에서 꺼낸다 */
+typedef struct {
+    _Atomic(shard_msg *) head;
+    shard_msg *tail; // 소비자 전용
+    shard_msg stub;
+} mpsc_queue;
+
+typedef struct {
+    client_info *c;     // NULL이면 빈 슬롯
+    uint32_t gen;
+    uint32_t next_free;
+} client_slot;
+
+/*
+ * 워커 샤드. 워커마다 자기 epoll 루프와 SO_REUSEPORT 리스너를 갖고,
+ * 커널이 나눠 준 연결을 끝까지 혼자 소유한다. 다른 스레드(다른 샤드, 센서, main)는
+ * 이 샤드의 클라이언트를 직접 만지지 않고 inbox에 넣은 뒤 wake_fd로 깨운다.
+ * 그래서 레지스트리, 송신 큐, 구독 묶음 어디에도 락이 없다.
+ */
+typedef struct {
+    int id;
+    pthread_t thread;
+    int epoll_fd, listen_fd, wake_fd;
+    // 레지스트리: 슬롯 맵(핸들 -> 클라이언트)과 방송용 조밀 배열, 둘 다 O(1) 추가/삭제
+    client_slot *slots;
+    uint32_t nslots, slot_cap;
+    uint32_t free_slot; // 빈 슬롯 목록 머리, UINT32_MAX면 없음
+    client_info **clients; // 순서 없음
+    int client_count, client_cap;
+    sub_bucket sub_buckets[SUB_MAX_BUCKETS];
+    int sub_bucket_count;
+    atomic_int nsubs;          // 0이면 샘플 알림을 보내지 않는다
+    mpsc_queue inbox;
+    atomic_int wake_pending;   // wake_fd에 이미 써 두었음
+    atomic_int sample_pending; // 새 센서 샘플이 있음 (스냅샷에서 직접 읽는다)
+} shard;
+
+shard *shards;
+int shard_count = 0;
+int worker_count = 0; // --workers, 0이면 CPU 수
+_Thread_local shard *cur_shard; // 워커 스레드에서만 설정됨
+atomic_int client_total = 0;
+
+/* 새로 들어온 클라이언트에게 보여 줄 최근 채팅/공지. 버퍼 참조만 보관한다 */
+#define BACKLOG_MAX 48 // 환영 인사, 센서, 예보와 함께 송신 큐(OUTQ_MAX_MSGS)에 들어가야 한다
+
+typedef struct {
+    msgbuf *text, *bin;
+    enum msg_kind kind;
+} backlog_entry;
+
+backlog_entry backlog_ring[BACKLOG_MAX];
+unsigned long backlog_n = 0; // 지금까지 넣은 수
+int backlog_size = 20;       // --backlog, 0이면 끔
+msgbuf *backlog_sensor_text, *backlog_sensor_bin; // 최신 샘플 요약, 샘플이 바뀐 뒤 첫 입장 때 만든다
+unsigned long backlog_sensor_seq = 0;
+pthread_mutex_t backlog_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * 블로킹/CPU 작업 풀. 스레드마다 제한된 작업 큐를 갖고, 자기 큐가 비면 다른 스레드의
+ * 큐에서 훔쳐 온다. 결과는 요청한 연결의 샤드 inbox로 완료 메시지를 보낸다.
+ * 종류별로 대기+실행 중 작업 수에 상한을 두어 한 종류가 풀을 독차지하지 못하게 한다.
+ */
+#define POOL_QUEUE_CAP 64
 
-int server_sfd = -1;
+enum task_type { TASK_RANGE, TASK_STATS, TASK_TYPES };
+const char *task_names[TASK_TYPES] = { "range", "stats" };
+int task_limit[TASK_TYPES] = { 8, 1 };
+
+typedef struct {
+    enum task_type type;
+    client_handle owner;
+    int binary;
+    uint64_t queued_ns;
+    char arg[BUF_SIZE];
+} task;
+
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    task *q[POOL_QUEUE_CAP]; // 원형 큐, 주인과 도둑 모두 앞에서 꺼낸다 (요청 순서 유지)
+    int head, count;
+} pool_worker;
+
+pool_worker *pool;
+int pool_size = 2; // --pool-threads
+atomic_uint pool_next = 0;
+pthread_mutex_t pool_idle_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t pool_idle = PTHREAD_COND_INITIALIZER;
+int pool_queued = 0; // pool_idle_lock으로 보호
+int pool_stop = 0;
+atomic_int task_inflight[TASK_TYPES]; // 대기 + 실행 중
+atomic_int task_running[TASK_TYPES];
+atomic_ullong task_rejected[TASK_TYPES];
+
+int epoll_fd = -1; // main 루프: 예보, HTTP, 표준입력, 지표
 volatile sig_atomic_t server_running = 1;
 
-time_t last_weather_notice = 0;
-time_t last_cloudy_notice = 0;
+/*
+ * 운영 지표. 스레드마다 자기 샤드에만 쓰고(단일 writer라 relaxed load/store로 충분),
+ * /stats와 Prometheus 리스너가 읽을 때 모든 샤드를 합친다.
+ * 지연 히스토그램은 HDR 방식: 2의 거듭제곱 구간마다 16칸, 상대 오차 6.25% 이내 (ns 단위).
+ */
+#define METRICS_MAX_SHARDS 64
+#define HDR_SUB_BITS 4
+#define HDR_MAX_EXP 40 // 2^40 ns (약 18분) 이상은 마지막 칸
+#define HDR_BUCKETS ((HDR_MAX_EXP - HDR_SUB_BITS + 2) << HDR_SUB_BITS)
+
+enum metric_counter {
+    MC_BYTES_IN,
+    MC_BYTES_OUT,
+    MC_KMA_FETCHES,
+    MC_KMA_FAILURES,
+    MC_READ_FAIL_BMP,
+    MC_READ_FAIL_BH,
+    MC_DEFLATE_IN,  // 압축 전 바이트 (메시지당 한 번)
+    MC_DEFLATE_OUT, // 압축 후 바이트
+    MC_COUNT
+};
+
+enum metric_hist {
+    MH_BROADCAST,   // 메시지 하나를 모든 수신자 큐에 넣기까지
+    MH_SHARD_QUEUE, // 다른 스레드가 보낸 방송이 샤드 inbox에서 기다린 시간
+    MH_KMA_FETCH,   // 기상청 요청 시작 ~ 완료
+    MH_READ_BMP,
+    MH_READ_BH,
+    MH_POOL_WAIT,   // 풀 작업이 큐에서 기다린 시간
+    MH_POOL_RUN,    // 풀 작업 실행 시간
+    MH_COUNT
+};
+
+typedef struct {
+    _Atomic uint64_t count, sum, max;
+    _Atomic uint64_t b[HDR_BUCKETS];
+} metric_hist;
+
+typedef struct {
+    _Atomic uint64_t c[MC_COUNT];
+    metric_hist h[MH_COUNT];
+} metrics_shard;
+
+metrics_shard *metrics_shards[METRICS_MAX_SHARDS];
+atomic_int metrics_nshards = 0;
+metrics_shard metrics_overflow; // 샤드가 모자라면 함께 쓴다 (갱신 일부 유실 가능)
+_Thread_local metrics_shard *metrics_self;
+time_t metrics_start;
+int metrics_port = 0; // --metrics-port, 0이면 끔
+int metrics_sfd = -1;
+int api_port = 0; // --api-port, 0이면 끔
+const char *api_bind = "127.0.0.1"; // --api-bind. 외부 대시보드에 열 때만 바꾼다
+int api_sfd = -1;
+
+/* 센서 장치 상태 (기존 응답 문구와 1:1 대응) */
+enum sensor_state {
+    SENSOR_OK,
+    SENSOR_READ_FAIL, // 읽기 실패
+    SENSOR_OPEN_FAIL, // 장치 열기 실패
+};
+
+/* 샘플링 엔진이 발행하는 최신 샘플 */
+typedef struct {
+    unsigned long seq;
+    struct timespec ts; // CLOCK_REALTIME
+    enum sensor_state temp_state, lux_state;
+    float temp;
+    int pressure; // Pa
+    int lux;
+} sensor_sample;
+
+/* seqlock: 쓰는 쪽은 sensor_monitor 하나, 읽는 쪽은 락 없이 재시도 */
+atomic_uint sensor_seq = 0;
+sensor_sample sensor_latest = { .temp_state = SENSOR_OPEN_FAIL, .lux_state = SENSOR_OPEN_FAIL };
+int sample_interval_ms = SAMPLE_DEFAULT_MS;
+int bmp_oss = -1; // -1이면 드라이버 설정 그대로
+const char *bmp_dev = "/dev/mybmp"; // 시험할 때는 같은 형식의 일반 파일도 된다
+const char *bh_dev = "/dev/mybh";
+
+/*
+ * 센서 백엔드. sensor_monitor가 read로 샘플을 채우고 wait로 다음 샘플까지 기다린다.
+ *   chardev              실제 장치 (--bmp-dev, --bh-dev)
+ *   synthetic[:SEED][:max] 하루 주기를 10분으로 줄인 합성 신호, max면 쉬지 않고 생성
+ *   replay:FILE[:N|max]  --record로 남긴 기록을 원래 시각 그대로 N배속(기본 1)으로 재생
+ */
+typedef struct sensor_backend {
+    const char *name;
+    int (*read)(struct sensor_backend *b, sensor_sample *smp); // 0, 재생이 끝나면 -1
+    void (*wait)(struct sensor_backend *b, struct timespec *next);
+    void (*close)(struct sensor_backend *b);
+    int fd_bmp, fd_bh;    // chardev
+    unsigned seed;        // synthetic
+    unsigned long n;
+    FILE *trace;          // replay
+    double speed;         // 0이면 최대 속도
+    long long prev_ms;
+} sensor_backend;
+
+sensor_backend sensor_src;
+const char *sensor_spec = "chardev";
+FILE *sensor_record = NULL; // --record
+
+/* 센서 이력: 원본 샘플 링 + 1초/1분/1시간 롤업. 모든 집계는 샘플이 들어올 때 갱신한다 */
+
+typedef struct {
+    time_t start;
+    float min, max;
+    double sum;
+    unsigned count;
+} hist_bucket;
+
+/* 한 해상도의 버킷 링과, 최근 window개 버킷에 대한 이동 집계 */
+typedef struct {
+    int period;          // 버킷 하나의 길이(초)
+    int cap;             // 보관 버킷 수
+    int window;          // 조회 창 = 진행 중 버킷 + 직전 window-1개
+    hist_bucket *ring;   // ring[serial % cap]
+    unsigned long n;     // 지금까지 확정된 버킷 수
+    hist_bucket cur;     // 진행 중 버킷
+    unsigned long wfirst;        // 창에 든 가장 오래된 버킷 번호
+    double wsum;
+    unsigned wcount;
+    unsigned long dq_min[HIST_WIN_MAX], dq_max[HIST_WIN_MAX]; // 단조 덱 (버킷 번호)
+    int min_head, min_len, max_head, max_len;
+} hist_level;
+
+enum { HIST_1S, HIST_1M, HIST_1H, HIST_LEVELS };
+
+typedef struct {
+    time_t ts;
+    unsigned char valid; // 1 << hist_metric
+    float v[HIST_COUNT];
+} hist_raw;
+
+hist_level history[HIST_COUNT][HIST_LEVELS];
+hist_raw hist_raw_ring[HIST_RAW_SAMPLES];
+unsigned long hist_raw_n = 0;
+pthread_mutex_t history_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * 영구 저장소: 고정 크기 세그먼트 파일(seg-NNNNNN.wsd)을 mmap해 추가만 한다.
+ * 세그먼트 = 헤더 + 블록 색인 배열 + 블록 데이터. 블록은 컬럼 단위로
+ * 시각(블록 기준 시각으로부터의 ms, u32)과 값(블록 기준값과의 차, i16)을 담는다.
+ * 고정 폭이라 SIMD로 바로 훑을 수 있고, 색인의 min/max/sum으로 통째 건너뛴다.
+ * 마지막 블록의 count가 커밋 지점이다.
+ */
+#define STORE_MAGIC "WXSEG01"
+#define STORE_VERSION 1
+#define STORE_BLOCK_SAMPLES 1024
+#define STORE_SEG_BLOCKS 256    // 1Hz 기준 세그먼트 하나에 약 3일
+#define STORE_MISSING INT16_MIN // 센서 실패 표시
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t nblocks; // 닫힌 블록 수, 열린 블록은 blk[nblocks]
+    uint32_t sealed;
+    uint32_t pad[11];
+} store_seg_hdr;
+
+typedef struct {
+    uint64_t base_ms, last_ms; // CLOCK_REALTIME ms
+    uint32_t count;
+    uint32_t nvalid[HIST_COUNT];
+    int32_t base[HIST_COUNT];  // 값 단위: 0.1°C, Pa, lux
+    int32_t min[HIST_COUNT], max[HIST_COUNT];
+    int64_t sum[HIST_COUNT];
+    uint64_t checksum;         // 닫힐 때 기록
+} store_block;
+
+typedef struct {
+    uint32_t ts[STORE_BLOCK_SAMPLES];
+    int16_t col[HIST_COUNT][STORE_BLOCK_SAMPLES];
+} store_data;
+
+#define STORE_DATA_OFF ((sizeof(store_seg_hdr) + STORE_SEG_BLOCKS * sizeof(store_block) + 4095) & ~(size_t)4095)
+#define STORE_SEG_BYTES (STORE_DATA_OFF + STORE_SEG_BLOCKS * sizeof(store_data))
+
+typedef struct {
+    unsigned id;
+    char *map;
+    store_seg_hdr *hdr;
+    store_block *blk;
+    store_data *data;
+} store_seg;
+
+/* 범위 집계 결과 (값 단위) */
+typedef struct {
+    int64_t sum;
+    int32_t min, max;
+    uint32_t count, above;
+} store_agg;
+
+const char *store_dir = NULL; // NULL이면 저장하지 않음
+store_seg *store_segs = NULL;
+int store_nsegs = 0;
+pthread_mutex_t store_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * 공지 규칙. 파일(--rules)에서 읽어 평평한 표로 컴파일한다. 한 줄에 규칙 하나:
+ *   이름 조건... [for=초] [cooldown=초] [once] [user=닉네임] | 메시지
+ * 조건은 temp|pressure|lux 와 >=,>,<=,< 비교이고 모두 만족해야 참이다.
+ * "lux>=1000~100" 처럼 ~ 뒤에 히스테리시스 폭을 주면 900 아래로 내려가야 꺼진다.
+ * 메시지의 {temp} {pressure} {lux}는 발송 시점 값으로 바뀐다.
+ */
+enum rule_op { RULE_GE, RULE_GT, RULE_LE, RULE_LT };
+
+/* 비교 하나. 신호별로 모아 두어 바뀐 신호의 항만 다시 평가한다 */
+typedef struct {
+    float enter, leave; // 켜지는 기준, 켜진 뒤 유지 기준
+    int rule;
+    unsigned char sig, op, on;
+} rule_term;
+
+typedef struct {
+    char name[32];
+    char user[NICK_SIZE]; // 비어 있으면 전체 공지
+    char *msg;
+    int nterms, nterms_on;
+    int for_sec, cooldown, once;
+    time_t true_since, last_fired;
+    int fired;      // once: 이번 참 구간에서 이미 알림
+    int active_pos; // rule_active 안의 위치, -1이면 조건 거짓
+} rule;
+
+const char default_rules[] =
+    "sunny  lux>=1000 temp>=27.0 cooldown=10 | ☀️ 날씨가 맑습니다. (현재 온도: {temp}°C, 조도: {lux} lux)\n"
+    "cloudy lux<=100 temp<=26.0 cooldown=10 | ☁️ 날이 흐립니다. (현재 온도: {temp}°C, 조도: {lux} lux)\n";
+
+const char *rules_path = NULL; // NULL이면 default_rules
+rule *rules = NULL;
+int rule_count = 0;
+rule_term *rule_terms = NULL;           // 신호 순으로 정렬
+int rule_sig_start[HIST_COUNT + 1];     // 신호 s의 항은 [start[s], start[s+1])
+int *rule_active = NULL;                // 조건이 참인 규칙
+int rule_active_count = 0;
+float rule_prev[HIST_COUNT];
+int rule_prev_valid[HIST_COUNT] = { -1, -1, -1 };
+time_t rule_next_due = 0; // 이 시각 전에는 발송할 규칙이 없음
+
+/* 초단기예보(getUltraSrtFcst) 카테고리 */
+enum kma_category {
+    CAT_T1H, // 기온
+    CAT_RN1, // 1시간 강수량
+    CAT_SKY, // 하늘상태
+    CAT_UUU, // 동서바람성분
+    CAT_VVV, // 남북바람성분
+    CAT_REH, // 습도
+    CAT_PTY, // 강수형태
+    CAT_LGT, // 낙뢰
+    CAT_VEC, // 풍향
+    CAT_WSD, // 풍속
+    CAT_COUNT,
+};
+
+const char *const kma_category_names[CAT_COUNT] = {
+    "T1H", "RN1", "SKY", "UUU", "VVV", "REH", "PTY", "LGT", "VEC", "WSD",
+};
+
+/* 응답 전체를 카테고리 x 격자 x 예보시각 표로 담는다 (카테고리별로 연속된 배열) */
+typedef struct {
+    int n_times;
+    int n_grids;
+    char fcst_date[FCST_MAX_TIMES][9];
+    int fcst_time[FCST_MAX_TIMES]; // HHMM
+    int nx[FCST_MAX_GRIDS], ny[FCST_MAX_GRIDS];
+    float value[CAT_COUNT][FCST_MAX_GRIDS][FCST_MAX_TIMES];
+    unsigned char present[CAT_COUNT][FCST_MAX_GRIDS][FCST_MAX_TIMES];
+    char result_code[8];
+} forecast_table;
+
+/* 청크 단위로 받는 JSON 토크나이저. 본문을 모으지 않고 한 번 훑으며 표를 채운다 */
+typedef struct {
+    forecast_table *table;
+    int in_string, escape, expect_value;
+    char key[16];
+    int key_len;
+    char tok[32]; // 현재 값 (문자열 또는 숫자)
+    int tok_len;
+    int tok_open; // 숫자/리터럴 토큰을 읽는 중
+    // 현재 item 객체에서 모은 필드
+    int cat, time, nx, ny;
+    char date[9];
+    char value[32];
+    int has_value;
+} kma_parser;
+
+/* 기상청 예보 캐시 스냅샷. 만들어진 뒤에는 바뀌지 않으며 포인터만 통째로 교체된다 */
+typedef struct {
+    atomic_int refs;
+    char base_date[9];
+    char base_time[5];
+    const char *nx, *ny;
+    int ok;      // 0이면 아직 성공한 적 없이 마지막 오류 메시지만 담고 있음
+    msgbuf *msg; // /weather 응답 그대로
+    msgbuf *bin; // 바이너리 클라이언트용 WIRE_FORECAST (실패면 WIRE_TEXT)
+    forecast_table table;
+} forecast_snapshot;
+
+forecast_snapshot *forecast_cur = NULL;
+pthread_mutex_t forecast_lock = PTHREAD_MUTEX_INITIALIZER; // forecast_cur 교체/참조 획득용
+atomic_ulong forecast_gen = 0; // forecast_cur가 바뀔 때마다 증가 (API ETag)
+
+/* 이하 예보 갱신 상태는 메인 루프 스레드만 건드린다 */
+int forecast_timerfd = -1;
+int forecast_kickfd = -1; // 워커의 갱신 요청은 이 eventfd로 메인 루프에 넘긴다
+int forecast_inflight = 0; // single-flight: 동시에 하나의 요청만
+int forecast_failures = 0;
+uint64_t forecast_req_ns;
+unsigned int forecast_seed;
+char forecast_req_date[9], forecast_req_time[5];
+forecast_table forecast_req_table; // 진행 중인 요청이 채우는 표
+kma_parser forecast_parser;
+
+const char *kma_url = "http://apis.data.go.kr/1360000/VilageFcstInfoService_2.0/getUltraSrtFcst";
+
+/* curl_multi 기반 비동기 HTTP 클라이언트. 메인 루프의 epoll에 소켓과 타이머를 올린다 */
+typedef struct http_request http_request;
+typedef void (*http_done_fn)(http_request *req, CURLcode res, long status);
+typedef void (*http_data_fn)(http_request *req, const char *data, size_t len);
+
+struct http_request {
+    CURL *easy;
+    http_data_fn on_data; // 본문이 도착할 때마다 청크 단위로 호출
+    http_done_fn done;
+    void *user;
+};
+
+typedef struct curl_sock {
+    io_handler io; // 반드시 첫 멤버
+    curl_socket_t fd;
+    struct curl_sock *next_dead;
+} curl_sock;
 
-char initial_weather[BUF_SIZE] = "";
+CURLM *http_multi = NULL;
+int http_timerfd = -1;
+CURL *http_idle[HTTP_MAX_IDLE_HANDLES];
+int http_idle_count = 0;
+curl_sock *http_dead_socks = NULL; // 이번 epoll 배치가 끝난 뒤 해제
+
+enum slow_policy slow_policy = SLOW_DROP;
+size_t outq_limit = OUTQ_DEFAULT_BYTES;
+
+const char ask_nick[] = COLOR_CYAN "사용할 id를 입력하세요: " COLOR_RESET;
 
 size_t write_callback(void *ptr, size_t size, size_t nmemb, void *userdata) {
-    size_t total = size * nmemb;
-    char *buf = (char*)userdata;
-    size_t curlen = strlen(buf);
-    if (curlen + total >= BUF_SIZE - 1) total = BUF_SIZE - 1 - curlen;
-    memcpy(buf + curlen, ptr, total);
-    buf[curlen + total] = '\0';
+    http_request *req = userdata;
+    req->on_data(req, ptr, size * nmemb);
     return size * nmemb;
 }
 
 void get_kma_date_time(char *date, char *base_time) {
     time_t t = time(NULL);
-    struct tm *tm = localtime(&t);
+    struct tm tmbuf, *tm = localtime_r(&t, &tmbuf);
     strftime(date, 9, "%Y%m%d", tm);
     int h = tm->tm_hour, m = tm->tm_min;
     int base_h[] = {2,5,8,11,14,17,20,23};
@@ -67,96 +622,195 @@ void get_kma_date_time(char *date, char *base_time) {
     sprintf(base_time, "%02d30", use);
 }
 
-const char* weather_emoji(const char* sky, const char* pty) {
-    if(strcmp(pty,"1")==0) return "🌧️";
-    if(strcmp(pty,"2")==0) return "🌧️";
-    if(strcmp(pty,"3")==0) return "🌨️";
-    if(strcmp(sky,"1")==0) return "☀️";
-    if(strcmp(sky,"4")==0) return "☁️";
-    if(strcmp(sky,"3")==0) return "⛅";
+const char* weather_emoji(int sky, int pty) {
+    if(pty==1) return "🌧️";
+    if(pty==2) return "🌧️";
+    if(pty==3) return "🌨️";
+    if(sky==1) return "☀️";
+    if(sky==4) return "☁️";
+    if(sky==3) return "⛅";
     return "";
 }
 
-void fetch_kma_weather(char *result, size_t maxlen) {
-    char base_date[9], base_time[5];
-    get_kma_date_time(base_date, base_time);
+void kma_build_url(const char *base_date, const char *base_time, char *url, size_t len) {
+    snprintf(url, len,
+        "%s?serviceKey=%s&numOfRows=60&pageNo=1&dataType=JSON"
+        "&base_date=%s&base_time=%s&nx=%s&ny=%s",
+        kma_url, KMA_SERVICE_KEY, base_date, base_time, KMA_NX, KMA_NY);
+}
 
-    int h = atoi(base_time)/100 + 1;
-    char fcstTime[5];
-    sprintf(fcstTime, "%02d00", h);
+void kma_parser_init(kma_parser *p, forecast_table *table) {
+    memset(p, 0, sizeof(*p));
+    memset(table, 0, sizeof(*table));
+    p->table = table;
+    p->cat = -1;
+}
 
-    char url[1024];
-    snprintf(url, sizeof(url),
-        "http://apis.data.go.kr/1360000/VilageFcstInfoService_2.0/getUltraSrtFcst"
-        "?serviceKey=%s&numOfRows=60&pageNo=1&dataType=JSON"
-        "&base_date=%s&base_time=%s&nx=%s&ny=%s",
-        KMA_SERVICE_KEY, base_date, base_time, KMA_NX, KMA_NY);
+int kma_find_category(const char *name) {
+    for (int i = 0; i < CAT_COUNT; i++)
+        if (strcmp(kma_category_names[i], name) == 0) return i;
+    return -1;
+}
 
-    char buf[BUF_SIZE] = {0};
-    CURL *curl = curl_easy_init();
-    if (!curl) {
-        snprintf(result, maxlen, COLOR_YELLOW "[서버] 기상청 API 초기화 실패\n" COLOR_RESET);
-        return;
+/* "강수없음", "1mm 미만", "30.0~50.0mm" 같은 값은 앞쪽 숫자만 쓰고, 숫자가 없으면 0 */
+float kma_parse_value(const char *v) {
+    while (*v && !(*v >= '0' && *v <= '9') && *v != '-' && *v != '.') {
+        if ((unsigned char)*v >= 0x80) return 0; // 한글로 시작 (강수없음 등)
+        v++;
     }
-    curl_easy_setopt(curl, CURLOPT_URL, url);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, buf);
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT, 5L);
-    CURLcode res = curl_easy_perform(curl);
-    curl_easy_cleanup(curl);
+    return strtof(v, NULL);
+}
 
-    if (res != CURLE_OK) {
-        snprintf(result, maxlen, COLOR_YELLOW "[서버] 기상청 API 요청 실패: %s\n" COLOR_RESET, curl_easy_strerror(res));
-        return;
+void kma_commit_item(kma_parser *p) {
+    forecast_table *t = p->table;
+    if (p->cat < 0 || !p->has_value || p->time < 0) return;
+    int g, k;
+    for (g = 0; g < t->n_grids; g++)
+        if (t->nx[g] == p->nx && t->ny[g] == p->ny) break;
+    if (g == t->n_grids) {
+        if (g == FCST_MAX_GRIDS) return;
+        t->nx[g] = p->nx;
+        t->ny[g] = p->ny;
+        t->n_grids++;
+    }
+    for (k = 0; k < t->n_times; k++)
+        if (t->fcst_time[k] == p->time && strcmp(t->fcst_date[k], p->date) == 0) break;
+    if (k == t->n_times) {
+        if (k == FCST_MAX_TIMES) return;
+        t->fcst_time[k] = p->time;
+        memcpy(t->fcst_date[k], p->date, sizeof(p->date));
+        t->n_times++;
     }
+    t->value[p->cat][g][k] = kma_parse_value(p->value);
+    t->present[p->cat][g][k] = 1;
+}
 
-    char t1h[16]="?", sky[16]="?", pty[16]="?";
-    char *p = buf;
-    int found = 0;
-    while ((p = strstr(p, "\"fcstTime\":\"")) != NULL) {
-        char timebuf[8] = {0};
-        sscanf(p, "\"fcstTime\":\"%7[^\"]", timebuf);
-        if (strcmp(timebuf, fcstTime) != 0) { p++; continue; }
-        char *t1h_ptr = strstr(p, "\"category\":\"T1H\"");
-        if (t1h_ptr) {
-            char *val_ptr = strstr(t1h_ptr, "\"fcstValue\":\"");
-            if (val_ptr) sscanf(val_ptr, "\"fcstValue\":\"%15[^\"]", t1h);
-        }
-        char *sky_ptr = strstr(p, "\"category\":\"SKY\"");
-        if (sky_ptr) {
-            char *val_ptr = strstr(sky_ptr, "\"fcstValue\":\"");
-            if (val_ptr) sscanf(val_ptr, "\"fcstValue\":\"%15[^\"]", sky);
-        }
-        char *pty_ptr = strstr(p, "\"category\":\"PTY\"");
-        if (pty_ptr) {
-            char *val_ptr = strstr(pty_ptr, "\"fcstValue\":\"");
-            if (val_ptr) sscanf(val_ptr, "\"fcstValue\":\"%15[^\"]", pty);
-        }
-        found = 1;
-        break;
+/* 키 하나에 대한 값이 끝났을 때. 관심 있는 키만 item 필드로 옮긴다 */
+void kma_end_value(kma_parser *p) {
+    p->tok[p->tok_len] = '\0';
+    const char *k = p->key;
+    if (strcmp(k, "category") == 0) p->cat = kma_find_category(p->tok);
+    else if (strcmp(k, "fcstValue") == 0) { snprintf(p->value, sizeof(p->value), "%s", p->tok); p->has_value = 1; }
+    else if (strcmp(k, "fcstTime") == 0) p->time = atoi(p->tok);
+    else if (strcmp(k, "fcstDate") == 0) snprintf(p->date, sizeof(p->date), "%.8s", p->tok);
+    else if (strcmp(k, "nx") == 0) p->nx = atoi(p->tok);
+    else if (strcmp(k, "ny") == 0) p->ny = atoi(p->tok);
+    else if (strcmp(k, "resultCode") == 0) snprintf(p->table->result_code, sizeof(p->table->result_code), "%.7s", p->tok);
+    p->expect_value = 0;
+    p->tok_open = 0;
+    p->tok_len = 0;
+}
+
+void kma_parser_feed(kma_parser *p, const char *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        char c = data[i];
+        if (p->in_string) {
+            if (p->escape) {
+                p->escape = 0;
+            } else if (c == '\\') {
+                p->escape = 1;
+                continue;
+            } else if (c == '"') {
+                p->in_string = 0;
+                if (p->expect_value) kma_end_value(p);
+                else p->key[p->key_len] = '\0';
+                continue;
+            }
+            // 관심 있는 값은 모두 짧으므로 넘치는 부분은 잘라낸다
+            if (p->expect_value) {
+                if (p->tok_len < (int)sizeof(p->tok) - 1) p->tok[p->tok_len++] = c;
+            } else {
+                if (p->key_len < (int)sizeof(p->key) - 1) p->key[p->key_len++] = c;
+            }
+            continue;
+        }
+        switch (c) {
+        case '"':
+            if (p->tok_open) kma_end_value(p);
+            p->in_string = 1;
+            if (p->expect_value) p->tok_len = 0;
+            else p->key_len = 0;
+            break;
+        case ':':
+            p->expect_value = 1;
+            p->tok_len = 0;
+            break;
+        case '{':
+            // item 객체는 중첩이 없으므로 객체가 열릴 때마다 필드를 초기화
+            p->expect_value = 0;
+            p->cat = -1;
+            p->time = -1;
+            p->nx = p->ny = 0;
+            p->date[0] = '\0';
+            p->has_value = 0;
+            break;
+        case '}':
+            if (p->tok_open) kma_end_value(p);
+            kma_commit_item(p);
+            p->cat = -1;
+            p->expect_value = 0;
+            break;
+        case ',': case ']':
+            if (p->tok_open) kma_end_value(p);
+            p->expect_value = 0;
+            break;
+        case '[':
+            p->expect_value = 0;
+            break;
+        case ' ': case '\t': case '\r': case '\n':
+            if (p->tok_open) kma_end_value(p);
+            break;
+        default:
+            // 숫자, true/false/null
+            if (p->expect_value) {
+                p->tok_open = 1;
+                if (p->tok_len < (int)sizeof(p->tok) - 1) p->tok[p->tok_len++] = c;
+            }
+            break;
+        }
     }
-    if (!found || strcmp(t1h,"?")==0) {
+}
+
+int forecast_find_grid(const forecast_table *t, int nx, int ny) {
+    for (int g = 0; g < t->n_grids; g++)
+        if (t->nx[g] == nx && t->ny[g] == ny) return g;
+    return -1;
+}
+
+int forecast_find_time(const forecast_table *t, int hhmm) {
+    for (int k = 0; k < t->n_times; k++)
+        if (t->fcst_time[k] == hhmm) return k;
+    return -1;
+}
+
+/* 성공하면 0, 실패하면 -1. 어느 쪽이든 result에 클라이언트에게 보낼 문장을 채운다 */
+int kma_render_weather(const forecast_table *t, const char *base_time, char *result, size_t maxlen) {
+    int h = (atoi(base_time)/100 + 1) % 24; // 2330 발표분은 0000시 예보
+    int g = forecast_find_grid(t, atoi(KMA_NX), atoi(KMA_NY));
+    int k = forecast_find_time(t, h * 100);
+    if (g < 0 || k < 0 || !t->present[CAT_T1H][g][k]) {
         snprintf(result, maxlen, COLOR_YELLOW "[서버] 기상청 API에서 해당 시간의 날씨 데이터를 찾을 수 없습니다.\n" COLOR_RESET);
-        return;
+        return -1;
     }
-    char sky_str[16]="";
-    if(strcmp(sky,"1")==0) strcpy(sky_str,"맑음");
-    else if(strcmp(sky,"3")==0) strcpy(sky_str,"구름많음");
-    else if(strcmp(sky,"4")==0) strcpy(sky_str,"흐림");
-    else strcpy(sky_str,"-");
-    char pty_str[16]="";
-    if(strcmp(pty,"0")==0) strcpy(pty_str,"강수없음");
-    else if(strcmp(pty,"1")==0) strcpy(pty_str,"비");
-    else if(strcmp(pty,"2")==0) strcpy(pty_str,"비/눈");
-    else if(strcmp(pty,"3")==0) strcpy(pty_str,"눈");
-    else strcpy(pty_str,"-");
+    int sky = t->present[CAT_SKY][g][k] ? (int)t->value[CAT_SKY][g][k] : -1;
+    int pty = t->present[CAT_PTY][g][k] ? (int)t->value[CAT_PTY][g][k] : -1;
+    const char *sky_str;
+    if(sky==1) sky_str="맑음";
+    else if(sky==3) sky_str="구름많음";
+    else if(sky==4) sky_str="흐림";
+    else sky_str="-";
+    const char *pty_str;
+    if(pty==0) pty_str="강수없음";
+    else if(pty==1) pty_str="비";
+    else if(pty==2) pty_str="비/눈";
+    else if(pty==3) pty_str="눈";
+    else pty_str="-";
 
     // 온도만 노란색으로 수동 처리
-    char temp[512];
-    snprintf(temp, sizeof(temp),
-        COLOR_YELLOW "📍" COLOR_RESET "강서구 화곡동 %s시 예보: %s%s, %s, 기온 " COLOR_YELLOW "%s" COLOR_RESET "°C\n",
-        fcstTime, weather_emoji(sky,pty), sky_str, pty_str, t1h);
-    snprintf(result, maxlen, "%s", temp);
+    snprintf(result, maxlen,
+        COLOR_YELLOW "📍" COLOR_RESET "강서구 화곡동 %02d00시 예보: %s%s, %s, 기온 " COLOR_YELLOW "%g" COLOR_RESET "°C\n",
+        h, weather_emoji(sky,pty), sky_str, pty_str, t->value[CAT_T1H][g][k]);
+    return 0;
 }
 
 float parse_temperature(const char *str) {
@@ -166,6 +820,14 @@ float parse_temperature(const char *str) {
     }
     return -999;
 }
+int parse_pressure(const char *str) {
+    long hpa, frac;
+    const char *p = strstr(str, "Pressure: ");
+    if (p && sscanf(p, "Pressure: %ld.%2ld", &hpa, &frac) == 2) {
+        return hpa * 100 + frac;
+    }
+    return -1;
+}
 int parse_lux(const char *str) {
     int lux;
     if (sscanf(str, "%d lux", &lux) == 1) {
@@ -174,339 +836,3443 @@ int parse_lux(const char *str) {
     return -1;
 }
 
-void broadcast_with_color(const char *msg, int sender_sock) {
-    pthread_mutex_lock(&mutex);
-    for (int i = 0; i < client_count; i++) {
-        int client_sock = clients[i].sockfd;
-        if (client_sock == sender_sock) {
-            dprintf(client_sock, COLOR_GREEN "%s" COLOR_RESET, msg); // 본인: 초록
-        } else {
-            dprintf(client_sock, "%s%s%s", COLOR_RESET, msg, COLOR_RESET); // 남: 흰색(기본)
-        }
-    }
-    pthread_mutex_unlock(&mutex);
+/* ---- 운영 지표 ---- */
+
+uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+metrics_shard *metrics_local(void) {
+    if (metrics_self) return metrics_self;
+    int i = atomic_fetch_add(&metrics_nshards, 1);
+    metrics_shard *s = i < METRICS_MAX_SHARDS ? calloc(1, sizeof(metrics_shard)) : NULL;
+    if (s) metrics_shards[i] = s;
+    return metrics_self = s ? s : &metrics_overflow;
 }
-void broadcast(const char *msg, int sender_sock, const char *color) {
-    pthread_mutex_lock(&mutex);
-    for (int i = 0; i < client_count; i++) {
-        int client_sock = clients[i].sockfd;
-        if (client_sock != sender_sock) {
-            dprintf(client_sock, "%s%s%s", color, msg, COLOR_RESET);
+
+static inline void metric_add(enum metric_counter c, uint64_t n) {
+    _Atomic uint64_t *p = &metrics_local()->c[c];
+    atomic_store_explicit(p, atomic_load_explicit(p, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+static inline int hdr_index(uint64_t v) {
+    if (v < (1u << HDR_SUB_BITS)) return (int)v;
+    int e = 63 - __builtin_clzll(v);
+    if (e > HDR_MAX_EXP) return HDR_BUCKETS - 1;
+    return ((e - HDR_SUB_BITS + 1) << HDR_SUB_BITS) + (int)((v >> (e - HDR_SUB_BITS)) & ((1u << HDR_SUB_BITS) - 1));
+}
+
+/* 칸이 담는 가장 큰 값 */
+uint64_t hdr_upper(int i) {
+    if (i < (1 << HDR_SUB_BITS)) return i;
+    int e = (i >> HDR_SUB_BITS) + HDR_SUB_BITS - 1;
+    uint64_t lo = (uint64_t)((1 << HDR_SUB_BITS) + (i & ((1 << HDR_SUB_BITS) - 1))) << (e - HDR_SUB_BITS);
+    return lo + (1ULL << (e - HDR_SUB_BITS)) - 1;
+}
+
+void metric_record(enum metric_hist h, uint64_t ns) {
+    metric_hist *m = &metrics_local()->h[h];
+    _Atomic uint64_t *b = &m->b[hdr_index(ns)];
+    atomic_store_explicit(b, atomic_load_explicit(b, memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic_store_explicit(&m->count, atomic_load_explicit(&m->count, memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic_store_explicit(&m->sum, atomic_load_explicit(&m->sum, memory_order_relaxed) + ns, memory_order_relaxed);
+    if (ns > atomic_load_explicit(&m->max, memory_order_relaxed))
+        atomic_store_explicit(&m->max, ns, memory_order_relaxed);
+}
+
+typedef struct {
+    uint64_t c[MC_COUNT];
+    struct {
+        uint64_t count, sum, max;
+        uint64_t b[HDR_BUCKETS];
+    } h[MH_COUNT];
+} metrics_total;
+
+void metrics_sum(metrics_total *t) {
+    int n = atomic_load(&metrics_nshards);
+    memset(t, 0, sizeof(*t));
+    for (int i = 0; i <= n && i <= METRICS_MAX_SHARDS; i++) {
+        metrics_shard *s = i < n && i < METRICS_MAX_SHARDS ? metrics_shards[i] : &metrics_overflow;
+        if (!s) continue; // 등록 중
+        for (int c = 0; c < MC_COUNT; c++) t->c[c] += atomic_load_explicit(&s->c[c], memory_order_relaxed);
+        for (int h = 0; h < MH_COUNT; h++) {
+            metric_hist *m = &s->h[h];
+            t->h[h].count += atomic_load_explicit(&m->count, memory_order_relaxed);
+            t->h[h].sum += atomic_load_explicit(&m->sum, memory_order_relaxed);
+            uint64_t mx = atomic_load_explicit(&m->max, memory_order_relaxed);
+            if (mx > t->h[h].max) t->h[h].max = mx;
+            for (int b = 0; b < HDR_BUCKETS; b++)
+                t->h[h].b[b] += atomic_load_explicit(&m->b[b], memory_order_relaxed);
         }
     }
-    pthread_mutex_unlock(&mutex);
 }
-void broadcast_shutdown() {
-    const char *shutdown_msg = COLOR_RED "[서버] 서버가 종료됩니다. 연결을 종료합니다.\n" COLOR_RESET;
-    pthread_mutex_lock(&mutex);
-    for (int i = 0; i < client_count; i++) {
-        send(clients[i].sockfd, shutdown_msg, strlen(shutdown_msg), 0);
-        close(clients[i].sockfd);
-    }
-    pthread_mutex_unlock(&mutex);
-}
-void remove_client(int sockfd) {
-    pthread_mutex_lock(&mutex);
-    for (int i = 0; i < client_count; i++) {
-        if (clients[i].sockfd == sockfd) {
-            for (int j = i; j < client_count - 1; j++) {
-                clients[j] = clients[j + 1];
-            }
-            client_count--;
-            break;
-        }
+
+uint64_t metrics_percentile(const metrics_total *t, int h, double q) {
+    uint64_t seen = 0, want = (uint64_t)(t->h[h].count * q);
+    if (want >= t->h[h].count && want > 0) want = t->h[h].count - 1;
+    for (int b = 0; b < HDR_BUCKETS; b++) {
+        seen += t->h[h].b[b];
+        if (seen > want) return hdr_upper(b) < t->h[h].max ? hdr_upper(b) : t->h[h].max;
     }
-    pthread_mutex_unlock(&mutex);
+    return t->h[h].max;
 }
-void *sensor_monitor(void *arg) {
-    int fd_bmp = open("/dev/mybmp", O_RDONLY);
-    int fd_bh = open("/dev/mybh", O_RDONLY);
-    if (fd_bmp < 0 || fd_bh < 0) {
-        perror("센서 장치 열기 실패");
-        return NULL;
+
+static const char *metric_hist_names[MH_COUNT] = {
+    "broadcast", "shard_queue", "kma_fetch", "read_bmp180", "read_bh1750", "pool_wait", "pool_run"
+};
+
+int metrics_clients(void) {
+    return atomic_load(&client_total);
+}
+
+/* /stats 응답. 분위수는 µs */
+void metrics_render_text(char *buf, size_t cap) {
+    metrics_total *t = malloc(sizeof(*t));
+    if (!t) {
+        snprintf(buf, cap, COLOR_CYAN "[서버]" COLOR_RESET " 통계를 만들 메모리가 없습니다.\n");
+        return;
     }
-    char temp_buf[BUF_SIZE], light_buf[BUF_SIZE];
-    while (server_running) {
-        lseek(fd_bmp, 0, SEEK_SET);
-        int n = read(fd_bmp, temp_buf, sizeof(temp_buf)-1);
-        if (n > 0) temp_buf[n] = '\0';
-        lseek(fd_bh, 0, SEEK_SET);
-        n = read(fd_bh, light_buf, sizeof(light_buf)-1);
-        if (n > 0) light_buf[n] = '\0';
-        float temp = parse_temperature(temp_buf);
-        int lux = parse_lux(light_buf);
-        time_t now = time(NULL);
-        if (lux >= 1000 && temp >= 27.0 && (now - last_weather_notice) >= 10) {
-            char notice[256];
-            snprintf(notice, sizeof(notice),
-                COLOR_YELLOW "[공지]" COLOR_RESET " ☀️ 날씨가 맑습니다. (현재 온도: " COLOR_YELLOW "%.1f" COLOR_RESET "°C, 조도: " COLOR_YELLOW "%d" COLOR_RESET " lux)\n", temp, lux);
-            broadcast(notice, -1, "");
-            last_weather_notice = now;
-        }
-        if (lux <= 100 && temp <= 26.0 && (now - last_cloudy_notice) >= 10) {
-            char notice[256];
-            snprintf(notice, sizeof(notice),
-                COLOR_YELLOW "[공지]" COLOR_RESET " ☁️ 날이 흐립니다. (현재 온도: " COLOR_YELLOW "%.1f" COLOR_RESET "°C, 조도: " COLOR_YELLOW "%d" COLOR_RESET " lux)\n", temp, lux);
-            broadcast(notice, -1, "");
-            last_cloudy_notice = now;
-        }
-        sleep(1);
-    }
-    close(fd_bmp); close(fd_bh);
-    return NULL;
+    metrics_sum(t);
+    size_t len = snprintf(buf, cap,
+        COLOR_CYAN "[서버]" COLOR_RESET " 통계 (가동 %ld초): 접속 %d명, 수신 %lluB, 송신 %lluB, 기상청 %llu회(실패 %llu), 센서 실패 bmp %llu bh %llu, 압축 %lluB→%lluB\n"
+        "  %-12s %10s %10s %10s %10s %10s\n",
+        (long)(time(NULL) - metrics_start), metrics_clients(),
+        (unsigned long long)t->c[MC_BYTES_IN], (unsigned long long)t->c[MC_BYTES_OUT],
+        (unsigned long long)t->c[MC_KMA_FETCHES], (unsigned long long)t->c[MC_KMA_FAILURES],
+        (unsigned long long)t->c[MC_READ_FAIL_BMP], (unsigned long long)t->c[MC_READ_FAIL_BH],
+        (unsigned long long)t->c[MC_DEFLATE_IN], (unsigned long long)t->c[MC_DEFLATE_OUT],
+        "", "count", "p50(us)", "p99(us)", "p99.9(us)", "max(us)");
+    for (int h = 0; h < MH_COUNT && len < cap; h++)
+        len += snprintf(buf + len, cap - len, "  %-12s %10llu %10.1f %10.1f %10.1f %10.1f\n",
+                        metric_hist_names[h], (unsigned long long)t->h[h].count,
+                        metrics_percentile(t, h, 0.5) / 1e3, metrics_percentile(t, h, 0.99) / 1e3,
+                        metrics_percentile(t, h, 0.999) / 1e3, t->h[h].max / 1e3);
+    for (int k = 0; k < TASK_TYPES && len < cap; k++)
+        len += snprintf(buf + len, cap - len, "  풀 %-9s 대기 %d, 실행 %d, 거절 %llu (상한 %d)\n", task_names[k],
+                        atomic_load(&task_inflight[k]) - atomic_load(&task_running[k]), atomic_load(&task_running[k]),
+                        (unsigned long long)atomic_load(&task_rejected[k]), task_limit[k]);
+    free(t);
 }
 
-void *client_handler(void *arg) {
-    client_info *cinfo = (client_info *)arg;
-    int sockfd = cinfo->sockfd;
-    char buf[BUF_SIZE];
-    char msg_with_nick[BUF_SIZE * 2];
-    int bytes_recv;
-    const char *ask_nick = COLOR_CYAN "사용할 id를 입력하세요: " COLOR_RESET;
-    send(sockfd, ask_nick, strlen(ask_nick), 0);
-    memset(cinfo->nickname, 0, NICK_SIZE);
-    while (1) {
-        bytes_recv = recv(sockfd, cinfo->nickname, NICK_SIZE-1, 0);
-        if (bytes_recv <= 0) {
-            close(sockfd);
-            free(cinfo);
-            return NULL;
+/* Prometheus 텍스트 형식. 히스토그램 le는 2의 거듭제곱 ns 경계(1µs ~ 약 69초) */
+char *metrics_render_prometheus(size_t *out_len) {
+    metrics_total *t = malloc(sizeof(*t));
+    char *buf = NULL;
+    size_t cap = 0;
+    FILE *f;
+    if (!t) return NULL;
+    if (!(f = open_memstream(&buf, &cap))) {
+        free(t);
+        return NULL;
+    }
+    metrics_sum(t);
+    fprintf(f, "# TYPE weather_clients_connected gauge\nweather_clients_connected %d\n", metrics_clients());
+    fprintf(f, "# TYPE weather_uptime_seconds gauge\nweather_uptime_seconds %ld\n", (long)(time(NULL) - metrics_start));
+    fprintf(f, "# TYPE weather_bytes_received_total counter\nweather_bytes_received_total %llu\n",
+            (unsigned long long)t->c[MC_BYTES_IN]);
+    fprintf(f, "# TYPE weather_bytes_sent_total counter\nweather_bytes_sent_total %llu\n",
+            (unsigned long long)t->c[MC_BYTES_OUT]);
+    fprintf(f, "# TYPE weather_kma_fetches_total counter\nweather_kma_fetches_total %llu\n",
+            (unsigned long long)t->c[MC_KMA_FETCHES]);
+    fprintf(f, "# TYPE weather_kma_fetch_failures_total counter\nweather_kma_fetch_failures_total %llu\n",
+            (unsigned long long)t->c[MC_KMA_FAILURES]);
+    fprintf(f, "# TYPE weather_sensor_read_failures_total counter\n"
+               "weather_sensor_read_failures_total{sensor=\"bmp180\"} %llu\n"
+               "weather_sensor_read_failures_total{sensor=\"bh1750\"} %llu\n",
+            (unsigned long long)t->c[MC_READ_FAIL_BMP], (unsigned long long)t->c[MC_READ_FAIL_BH]);
+    fprintf(f, "# TYPE weather_deflate_bytes_total counter\n"
+               "weather_deflate_bytes_total{stage=\"in\"} %llu\n"
+               "weather_deflate_bytes_total{stage=\"out\"} %llu\n",
+            (unsigned long long)t->c[MC_DEFLATE_IN], (unsigned long long)t->c[MC_DEFLATE_OUT]);
+    fprintf(f, "# TYPE weather_pool_queue_depth gauge\n");
+    for (int k = 0; k < TASK_TYPES; k++)
+        fprintf(f, "weather_pool_queue_depth{type=\"%s\"} %d\n", task_names[k],
+                atomic_load(&task_inflight[k]) - atomic_load(&task_running[k]));
+    fprintf(f, "# TYPE weather_pool_running gauge\n");
+    for (int k = 0; k < TASK_TYPES; k++)
+        fprintf(f, "weather_pool_running{type=\"%s\"} %d\n", task_names[k], atomic_load(&task_running[k]));
+    fprintf(f, "# TYPE weather_pool_rejected_total counter\n");
+    for (int k = 0; k < TASK_TYPES; k++)
+        fprintf(f, "weather_pool_rejected_total{type=\"%s\"} %llu\n", task_names[k],
+                (unsigned long long)atomic_load(&task_rejected[k]));
+    for (int h = 0; h < MH_COUNT; h++) {
+        const char *name = metric_hist_names[h], *label = "", *sel = "";
+        char metric[64];
+        if (h == MH_READ_BMP || h == MH_READ_BH) {
+            name = "sensor_read";
+            label = h == MH_READ_BMP ? "sensor=\"bmp180\"," : "sensor=\"bh1750\",";
+            sel = h == MH_READ_BMP ? "{sensor=\"bmp180\"}" : "{sensor=\"bh1750\"}";
+        }
+        snprintf(metric, sizeof(metric), "weather_%s_seconds", name);
+        if (h != MH_READ_BH) fprintf(f, "# TYPE %s histogram\n", metric);
+        uint64_t cum = 0;
+        int b = 0;
+        for (int e = 10; e <= 36; e++) {
+            for (; b < HDR_BUCKETS && hdr_upper(b) < (1ULL << e); b++) cum += t->h[h].b[b];
+            fprintf(f, "%s_bucket{%sle=\"%.9g\"} %llu\n", metric, label, (double)(1ULL << e) / 1e9, (unsigned long long)cum);
         }
-        size_t nicklen = strlen(cinfo->nickname);
-        if (nicklen > 0 && cinfo->nickname[nicklen-1] == '\n')
-            cinfo->nickname[nicklen-1] = '\0';
-        if (strlen(cinfo->nickname) > 0) break;
-        send(sockfd, ask_nick, strlen(ask_nick), 0);
+        fprintf(f, "%s_bucket{%sle=\"+Inf\"} %llu\n", metric, label, (unsigned long long)t->h[h].count);
+        fprintf(f, "%s_sum%s %.9f\n", metric, sel, t->h[h].sum / 1e9);
+        fprintf(f, "%s_count%s %llu\n", metric, sel, (unsigned long long)t->h[h].count);
     }
-    char welcome[BUF_SIZE*2];
-    snprintf(welcome, sizeof(welcome),
-        COLOR_CYAN "[알림] 당신의 ID는 " COLOR_GREEN "%s" COLOR_CYAN " 입니다. ☀️'" COLOR_YELLOW "웨더" COLOR_CYAN "'에 오신걸 환영합니다.\n" COLOR_RESET,
-        cinfo->nickname);
-    send(sockfd, welcome, strlen(welcome), 0);
+    free(t);
+    if (fclose(f) != 0) {
+        free(buf);
+        return NULL;
+    }
+    *out_len = cap;
+    return buf;
+}
 
-    while (server_running) {
-        memset(buf, 0, sizeof(buf));
-        bytes_recv = recv(sockfd, buf, sizeof(buf) - 1, 0);
-        if (bytes_recv <= 0) break;
-        buf[bytes_recv] = '\0';
-        size_t len = strlen(buf);
-        if (len > 0 && buf[len - 1] == '\n') buf[len - 1] = '\0';
-
-        if (buf[0] == '/') {
-            if (strcmp(buf, "/weather") == 0) {
-                char reply[BUF_SIZE];
-                fetch_kma_weather(reply, sizeof(reply));
-                if (strstr(reply, "기상청 API 요청 실패") != NULL ||
-                    strstr(reply, "날씨 데이터를 찾을 수 없습니다") != NULL) {
-                    send(sockfd, initial_weather, strlen(initial_weather), 0);
-                } else {
-                    send(sockfd, reply, strlen(reply), 0);
-                    strncpy(initial_weather, reply, sizeof(initial_weather)-1);
-                }
-                continue;
-            } else if (strcmp(buf, "/temp") == 0) {
-                int fd = open("/dev/mybmp", O_RDONLY);
-                if (fd >= 0) {
-                    char temp_buf[BUF_SIZE];
-                    int n = read(fd, temp_buf, sizeof(temp_buf)-1);
-                    if (n > 0) {
-                        temp_buf[n] = '\0';
-                        float temp = parse_temperature(temp_buf);
-                        char msg[128];
-                        snprintf(msg, sizeof(msg), "[서버] 현재 온도: " COLOR_YELLOW "%.1f" COLOR_RESET "°C\n", temp);
-                        send(sockfd, msg, strlen(msg), 0);
-                    } else {
-                        const char *msg = COLOR_CYAN "[서버]" COLOR_RESET " 온도 센서 읽기 실패\n";
-                        send(sockfd, msg, strlen(msg), 0);
-                    }
-                    close(fd);
-                } else {
-                    const char *msg = COLOR_CYAN "[서버]" COLOR_RESET " 온도 센서 장치 열기 실패\n";
-                    send(sockfd, msg, strlen(msg), 0);
-                }
-                continue;
-            } else if (strcmp(buf, "/lux") == 0) {
-                int fd = open("/dev/mybh", O_RDONLY);
-                if (fd >= 0) {
-                    char light_buf[BUF_SIZE];
-                    int n = read(fd, light_buf, sizeof(light_buf)-1);
-                    if (n > 0) {
-                        light_buf[n] = '\0';
-                        int lux = parse_lux(light_buf);
-                        char msg[128];
-                        snprintf(msg, sizeof(msg), "[서버] 현재 조도: " COLOR_YELLOW "%d" COLOR_RESET " lux\n", lux);
-                        send(sockfd, msg, strlen(msg), 0);
-                    } else {
-                        const char *msg = COLOR_CYAN "[서버]" COLOR_RESET " 조도 센서 읽기 실패\n";
-                        send(sockfd, msg, strlen(msg), 0);
-                    }
-                    close(fd);
-                } else {
-                    const char *msg = COLOR_CYAN "[서버]" COLOR_RESET " 조도 센서 장치 열기 실패\n";
-                    send(sockfd, msg, strlen(msg), 0);
-                }
-                continue;
-            } else {
-                const char *msg = COLOR_CYAN "[서버]" COLOR_RESET " 알 수 없는 명령어입니다. 명령어 목록: /temp, /lux, /weather\n";
-                send(sockfd, msg, strlen(msg), 0);
-                continue;
-            }
-        }
+void metrics_cleanup(void) {
+    int n = atomic_load(&metrics_nshards);
+    for (int i = 0; i < n && i < METRICS_MAX_SHARDS; i++) free(metrics_shards[i]);
+}
 
-        snprintf(msg_with_nick, sizeof(msg_with_nick), "%s: %s\n", cinfo->nickname, buf);
-        broadcast_with_color(msg_with_nick, sockfd);
-        printf("%s", msg_with_nick);
-    }
-    printf(COLOR_RED "[서버] %s 클라이언트 연결 종료\n"COLOR_RESET, cinfo->nickname);
-    close(sockfd);
-    remove_client(sockfd);
-    free(cinfo);
-    return NULL;
+msgbuf *msgbuf_printf(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+    if (len < 0) return NULL;
+    msgbuf *b = malloc(sizeof(msgbuf) + len + 1);
+    if (!b) return NULL;
+    atomic_init(&b->refs, 1);
+    atomic_init(&b->deflated, NULL);
+    b->len = len;
+    va_start(ap, fmt);
+    vsnprintf(b->data, len + 1, fmt, ap);
+    va_end(ap);
+    return b;
 }
 
-void sigint_handler(int sig) {
-    (void)sig;
-    printf(COLOR_RED "\n[서버] Ctrl+C 신호 감지, 서버 종료 시작...\n" COLOR_RESET);
-    server_running = 0;
-    if (server_sfd != -1) {
-        close(server_sfd);
-        server_sfd = -1;
+msgbuf *msgbuf_ref(msgbuf *b) {
+    atomic_fetch_add_explicit(&b->refs, 1, memory_order_relaxed);
+    return b;
+}
+
+void msgbuf_unref(msgbuf *b) {
+    if (b && atomic_fetch_sub_explicit(&b->refs, 1, memory_order_acq_rel) == 1) {
+        msgbuf_unref(atomic_load_explicit(&b->deflated, memory_order_acquire));
+        free(b);
     }
-    broadcast_shutdown();
 }
 
-int main(void) {
-    setlocale(LC_ALL, "");
-    struct sockaddr_in server_addr, client_addr;
-    socklen_t sock_size;
-    int yes = 1;
-    pthread_t tid;
-    struct sigaction sa;
-    sa.sa_handler = sigint_handler;
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = 0;
-    sigaction(SIGINT, &sa, NULL);
-    curl_global_init(CURL_GLOBAL_DEFAULT);
+/* 바이너리 프레임(type | len | payload) 하나를 msgbuf로 만든다 */
+msgbuf *msgbuf_frame(int type, const void *payload, size_t len) {
+    if (len > WIRE_MAX_PAYLOAD) len = WIRE_MAX_PAYLOAD;
+    msgbuf *b = malloc(sizeof(msgbuf) + WIRE_HDR_SIZE + len + 1);
+    if (!b) return NULL;
+    atomic_init(&b->refs, 1);
+    atomic_init(&b->deflated, NULL);
+    b->len = WIRE_HDR_SIZE + len;
+    b->data[0] = type;
+    wire_put16((unsigned char *)b->data + 1, len);
+    memcpy(b->data + WIRE_HDR_SIZE, payload, len);
+    b->data[b->len] = '\0';
+    return b;
+}
 
-    fetch_kma_weather(initial_weather, sizeof(initial_weather));
-    printf(COLOR_CYAN "%s" COLOR_RESET, initial_weather);
+/* 압축기는 스레드마다 하나. 프레임마다 reset 후 사전을 다시 넣는다 */
+pthread_key_t deflate_key;
+pthread_once_t deflate_once = PTHREAD_ONCE_INIT;
 
-    pthread_t sensor_thread;
-    pthread_create(&sensor_thread, NULL, sensor_monitor, NULL);
+void deflate_stream_free(void *p) {
+    deflateEnd(p);
+    free(p);
+}
 
-    if ((server_sfd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
-        perror("socket() error");
-        exit(1);
+void deflate_key_init(void) {
+    pthread_key_create(&deflate_key, deflate_stream_free);
+}
+
+z_stream *deflate_stream(void) {
+    pthread_once(&deflate_once, deflate_key_init);
+    z_stream *zs = pthread_getspecific(deflate_key);
+    if (zs) return zs;
+    zs = calloc(1, sizeof(*zs));
+    if (!zs) return NULL;
+    if (deflateInit2(zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        free(zs);
+        return NULL;
     }
-    if (setsockopt(server_sfd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int)) == -1) {
-        perror("setsockopt() error");
-        exit(1);
+    pthread_setspecific(deflate_key, zs);
+    return zs;
+}
+
+/*
+ * 압축 연결에 보낼 WIRE_DEFLATE 판. 원문 하나당 한 번만 압축해 원문에 붙여 두므로
+ * 수신자가 몇 명이든, 어느 샤드에서 보내든 같은 버퍼를 공유한다.
+ * 두 샤드가 동시에 만들면 먼저 붙인 쪽을 쓰고 나머지는 버린다.
+ */
+msgbuf *msgbuf_deflated(msgbuf *b) {
+    msgbuf *z = atomic_load_explicit(&b->deflated, memory_order_acquire);
+    if (z) return z;
+    z_stream *zs = deflate_stream();
+    if (!zs) return NULL;
+    size_t cap = 0;
+    for (size_t off = 0; off < b->len; off += WIRE_DEFLATE_CHUNK) {
+        size_t n = b->len - off < WIRE_DEFLATE_CHUNK ? b->len - off : WIRE_DEFLATE_CHUNK;
+        cap += WIRE_HDR_SIZE + deflateBound(zs, n);
     }
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(10000);
-    server_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    memset(&(server_addr.sin_zero), '\0', 8);
-    if (bind(server_sfd, (struct sockaddr *)&server_addr, sizeof(struct sockaddr)) == -1) {
-        perror("bind() error");
-        exit(1);
+    if (!(z = malloc(sizeof(msgbuf) + cap + 1))) return NULL;
+    atomic_init(&z->refs, 1);
+    atomic_init(&z->deflated, NULL);
+    z->len = 0;
+    for (size_t off = 0; off < b->len; off += WIRE_DEFLATE_CHUNK) {
+        size_t n = b->len - off < WIRE_DEFLATE_CHUNK ? b->len - off : WIRE_DEFLATE_CHUNK;
+        unsigned char *hdr = (unsigned char *)z->data + z->len;
+        deflateReset(zs);
+        deflateSetDictionary(zs, (const Bytef *)wire_deflate_dict, sizeof(wire_deflate_dict) - 1);
+        zs->next_in = (Bytef *)b->data + off;
+        zs->avail_in = n;
+        zs->next_out = hdr + WIRE_HDR_SIZE;
+        zs->avail_out = cap - z->len - WIRE_HDR_SIZE;
+        if (deflate(zs, Z_FINISH) != Z_STREAM_END || zs->total_out > WIRE_MAX_PAYLOAD) {
+            free(z);
+            return NULL;
+        }
+        hdr[0] = WIRE_DEFLATE;
+        wire_put16(hdr + 1, zs->total_out);
+        z->len += WIRE_HDR_SIZE + zs->total_out;
     }
-    if (listen(server_sfd, 5) == -1) {
-        perror("listen() error");
-        exit(1);
+    z->data[z->len] = '\0';
+    metric_add(MC_DEFLATE_IN, b->len);
+    metric_add(MC_DEFLATE_OUT, z->len);
+    msgbuf *expected = NULL;
+    if (!atomic_compare_exchange_strong_explicit(&b->deflated, &expected, z,
+                                                 memory_order_acq_rel, memory_order_acquire)) {
+        free(z);
+        return expected;
     }
+    return z;
+}
 
-    printf(COLOR_CYAN "[서버] " COLOR_YELLOW "채팅 서버 시작!" COLOR_CYAN " 포트: 10000\n" COLOR_RESET);
-    printf(COLOR_CYAN "[서버] 채팅 입력 시 모든 클라이언트에게 " COLOR_YELLOW "공지" COLOR_CYAN "로 전송됩니다.\n" COLOR_RESET);
-    printf(COLOR_CYAN "[서버] " COLOR_YELLOW "센서 모니터링" COLOR_CYAN " 활성화됨\n" COLOR_RESET);
-
-    int flags = fcntl(STDIN_FILENO, F_GETFL, 0);
-    fcntl(STDIN_FILENO, F_SETFL, flags | O_NONBLOCK);
+/* 색상 코드와 끝 줄바꿈을 걷어낸 텍스트 프레임. WIRE_CHAT/WIRE_NOTICE는 이름을 앞에 붙인다 */
+msgbuf *msgbuf_text_frame(int type, const char *name, const char *text) {
+    size_t tlen = strlen(text), n = 0;
+    unsigned char *p = malloc(tlen + 256);
+    if (!p) return NULL;
+    if (type == WIRE_CHAT || type == WIRE_NOTICE) {
+        size_t nl = name ? strlen(name) : 0;
+        if (nl > 255) nl = 255;
+        p[n++] = nl;
+        memcpy(p + n, name, nl);
+        n += nl;
+    }
+    for (const char *s = text; *s; s++) {
+        if (s[0] == '\033' && s[1] == '[') {
+            s += 2;
+            while (*s && *s != 'm') s++;
+            if (!*s) break;
+            continue;
+        }
+        p[n++] = *s;
+    }
+    if (n > 0 && p[n - 1] == '\n') n--;
+    msgbuf *b = msgbuf_frame(type, p, n);
+    free(p);
+    return b;
+}
 
-    while (server_running) {
-        fd_set readfds;
-        FD_ZERO(&readfds);
-        FD_SET(server_sfd, &readfds);
-        FD_SET(STDIN_FILENO, &readfds);
+msgbuf *msgbuf_sample_frame(const sensor_sample *smp, int topic) {
+    unsigned char p[WIRE_SAMPLE_SIZE];
+    int temp = smp->temp_state == SENSOR_OK ? (int)(smp->temp * 10 + (smp->temp < 0 ? -0.5f : 0.5f)) : INT16_MIN;
+    wire_put64(p, (uint64_t)smp->ts.tv_sec * 1000 + smp->ts.tv_nsec / 1000000);
+    p[8] = topic;
+    p[9] = smp->temp_state;
+    p[10] = smp->lux_state;
+    wire_put16(p + 11, (uint16_t)(int16_t)temp);
+    wire_put32(p + 13, smp->temp_state == SENSOR_OK ? (uint32_t)smp->pressure : UINT32_MAX);
+    wire_put32(p + 17, smp->lux_state == SENSOR_OK ? (uint32_t)smp->lux : UINT32_MAX);
+    return msgbuf_frame(WIRE_SAMPLE, p, sizeof(p));
+}
 
-        int maxfd = (server_sfd > STDIN_FILENO) ? server_sfd : STDIN_FILENO;
-        struct timeval timeout = {1, 0};
+/* 우리 격자의 시간대별 예보를 고정 폭 항목으로 싣는다. 없는 값은 모든 비트 1 */
+msgbuf *msgbuf_forecast_frame(const forecast_table *t, const char *base_date, const char *base_time) {
+    unsigned char p[13 + FCST_MAX_TIMES * WIRE_FORECAST_ENTRY_SIZE];
+    int g = forecast_find_grid(t, atoi(KMA_NX), atoi(KMA_NY)), n = 0;
+    memcpy(p, base_date, 8);
+    memcpy(p + 8, base_time, 4);
+    for (int k = 0; g >= 0 && k < t->n_times; k++) {
+        unsigned char *e = p + 13 + n++ * WIRE_FORECAST_ENTRY_SIZE;
+#define FCST_VAL(cat, scale, none) (t->present[cat][g][k] ? (int)(t->value[cat][g][k] * (scale) + 0.5f) : (none))
+        wire_put16(e, t->fcst_time[k]);
+        float t1h = t->value[CAT_T1H][g][k] * 10;
+        wire_put16(e + 2, t->present[CAT_T1H][g][k] ? (uint16_t)(int16_t)(t1h + (t1h < 0 ? -0.5f : 0.5f)) : 0xFFFF);
+        e[4] = FCST_VAL(CAT_SKY, 1, 0xFF);
+        e[5] = FCST_VAL(CAT_PTY, 1, 0xFF);
+        wire_put16(e + 6, FCST_VAL(CAT_RN1, 10, 0xFFFF));
+        e[8] = FCST_VAL(CAT_REH, 1, 0xFF);
+        wire_put16(e + 9, FCST_VAL(CAT_WSD, 10, 0xFFFF));
+#undef FCST_VAL
+    }
+    p[12] = n;
+    return msgbuf_frame(WIRE_FORECAST, p, 13 + n * WIRE_FORECAST_ENTRY_SIZE);
+}
 
-        int ready = select(maxfd + 1, &readfds, NULL, NULL, &timeout);
+/* 이하 outq_* 함수는 모두 클라이언트를 소유한 워커에서만 호출한다 */
+void outq_pop(client_info *c) {
+    out_msg *m = &c->outq[c->outq_head];
+    if (m->kind == MSG_STREAM) c->stream_queued &= ~(1u << m->topic);
+    c->outq_bytes -= m->buf->len;
+    msgbuf_unref(m->buf);
+    c->outq_head = (c->outq_head + 1) % OUTQ_MAX_MSGS;
+    c->outq_count--;
+    c->outq_off = 0;
+}
 
-        if (ready < 0) {
-            if (!server_running) break;
-            perror("select() error");
-            continue;
-        }
+void outq_clear(client_info *c) {
+    while (c->outq_count > 0) outq_pop(c);
+}
 
-        if (FD_ISSET(server_sfd, &readfds)) {
-            sock_size = sizeof(struct sockaddr_in);
-            int client_sfd = accept(server_sfd, (struct sockaddr *)&client_addr, &sock_size);
-            if (client_sfd == -1) {
-                if (!server_running) break;
-                perror("accept() error");
-                continue;
-            }
-            pthread_mutex_lock(&mutex);
-            if (client_count >= MAX_CLIENTS) {
-                printf("[서버] 최대 클라이언트 수 초과, 접속 거부\n");
-                close(client_sfd);
-                pthread_mutex_unlock(&mutex);
-                continue;
+/* 아직 한 바이트도 안 보낸 메시지만 버린다. keep_sensor면 마지막 센서 공지는 남김 */
+void outq_skip_ahead(client_info *c, int keep_sensor) {
+    int first = (c->outq_off > 0) ? 1 : 0; // 일부 전송된 head는 스트림이 깨지지 않게 유지
+    int latest = -1;
+    if (keep_sensor) {
+        for (int i = c->outq_count - 1; i >= first; i--) {
+            if (c->outq[(c->outq_head + i) % OUTQ_MAX_MSGS].kind == MSG_SENSOR) {
+                latest = i;
+                break;
             }
-            client_info *cinfo = malloc(sizeof(client_info));
-            if (!cinfo) {
-                perror("malloc() error");
-                close(client_sfd);
-                pthread_mutex_unlock(&mutex);
-                continue;
+        }
+    }
+    int kept = first;
+    for (int i = first; i < c->outq_count; i++) {
+        out_msg *m = &c->outq[(c->outq_head + i) % OUTQ_MAX_MSGS];
+        if (i == latest) {
+            c->outq[(c->outq_head + kept++) % OUTQ_MAX_MSGS] = *m;
+        } else {
+            if (m->kind == MSG_STREAM) c->stream_queued &= ~(1u << m->topic);
+            c->outq_bytes -= m->buf->len;
+            msgbuf_unref(m->buf);
+        }
+    }
+    c->outq_count = kept;
+}
+
+/* 큐에 쌓인 메시지를 writev 한 번으로 최대한 내보낸다. EAGAIN이면 EPOLLOUT에서 재개 */
+void client_flush(client_info *c) {
+    while (c->outq_count > 0) {
+        struct iovec iov[OUTQ_MAX_MSGS];
+        for (int i = 0; i < c->outq_count; i++) {
+            out_msg *m = &c->outq[(c->outq_head + i) % OUTQ_MAX_MSGS];
+            size_t off = (i == 0) ? c->outq_off : 0;
+            iov[i].iov_base = m->buf->data + off;
+            iov[i].iov_len = m->buf->len - off;
+        }
+        ssize_t sent = writev(c->sockfd, iov, c->outq_count);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+            outq_clear(c);
+            c->closing = 1;
+            shutdown(c->sockfd, SHUT_RDWR); // 메인 루프가 EOF를 보고 정리
+            return;
+        }
+        metric_add(MC_BYTES_OUT, sent);
+        size_t left = sent;
+        while (left > 0) {
+            size_t rem = c->outq[c->outq_head].buf->len - c->outq_off;
+            if (left < rem) {
+                c->outq_off += left;
+                break;
+            }
+            left -= rem;
+            outq_pop(c);
+        }
+    }
+}
+
+/* 버퍼 참조만 큐에 넣고 바로 flush를 시도한다. 블로킹하지 않음 */
+void client_enqueue_topic(client_info *c, msgbuf *b, enum msg_kind kind, int topic) {
+    if (c->closing || b->len == 0) return;
+    if (c->deflate && !(b = msgbuf_deflated(b))) return;
+    size_t len = b->len;
+    if (c->outq_count >= OUTQ_MAX_MSGS || c->outq_bytes + len > outq_limit) {
+        client_flush(c); // 그 사이 소켓이 비었을 수도 있음
+    }
+    if (c->outq_count >= OUTQ_MAX_MSGS || c->outq_bytes + len > outq_limit) {
+        switch (slow_policy) {
+        case SLOW_DROP:
+            return;
+        case SLOW_LATEST:
+            outq_skip_ahead(c, kind != MSG_SENSOR);
+            if (kind != MSG_SENSOR) return;
+            if (c->outq_count < OUTQ_MAX_MSGS && c->outq_bytes + len <= outq_limit) break;
+            return;
+        case SLOW_DISCONNECT:
+            printf(COLOR_RED "[서버] %s 클라이언트 송신 지연으로 연결 종료\n" COLOR_RESET, c->nickname);
+            outq_clear(c);
+            c->closing = 1;
+            shutdown(c->sockfd, SHUT_RDWR);
+            return;
+        }
+    }
+    out_msg *m = &c->outq[(c->outq_head + c->outq_count) % OUTQ_MAX_MSGS];
+    m->buf = msgbuf_ref(b);
+    m->kind = kind;
+    m->topic = topic;
+    if (kind == MSG_STREAM) c->stream_queued |= 1u << topic;
+    c->outq_count++;
+    c->outq_bytes += len;
+    if (!c->corked) client_flush(c);
+}
+
+void client_enqueue(client_info *c, msgbuf *b, enum msg_kind kind) {
+    client_enqueue_topic(c, b, kind, 0);
+}
+
+/* 구독 갱신. 같은 신호의 이전 갱신이 아직 한 바이트도 안 나갔으면 그 자리를 최신 값으로 바꾼다 */
+void client_enqueue_stream(client_info *c, msgbuf *b, int topic) {
+    if (c->closing) return;
+    if (c->stream_queued & (1u << topic)) {
+        msgbuf *w = c->deflate ? msgbuf_deflated(b) : b;
+        if (!w) return;
+        int first = (c->outq_off > 0) ? 1 : 0;
+        for (int i = c->outq_count - 1; i >= first; i--) {
+            out_msg *m = &c->outq[(c->outq_head + i) % OUTQ_MAX_MSGS];
+            if (m->kind == MSG_STREAM && m->topic == topic) {
+                c->outq_bytes += w->len - m->buf->len;
+                msgbuf_unref(m->buf);
+                m->buf = msgbuf_ref(w);
+                return;
+            }
+        }
+    }
+    client_enqueue_topic(c, b, MSG_STREAM, topic);
+}
+
+void client_send(client_info *c, const char *msg) {
+    msgbuf *b = c->binary ? msgbuf_text_frame(WIRE_TEXT, NULL, msg) : msgbuf_printf("%s", msg);
+    if (!b) return;
+    client_enqueue(c, b, MSG_TEXT);
+    msgbuf_unref(b);
+}
+
+/* ---- 샤드 간 방송 ---- */
+
+void mpsc_init(mpsc_queue *q) {
+    atomic_init(&q->stub.next, NULL);
+    atomic_init(&q->head, &q->stub);
+    q->tail = &q->stub;
+}
+
+void mpsc_push(mpsc_queue *q, shard_msg *n) {
+    atomic_store_explicit(&n->next, NULL, memory_order_relaxed);
+    shard_msg *prev = atomic_exchange_explicit(&q->head, n, memory_order_acq_rel);
+    atomic_store_explicit(&prev->next, n, memory_order_release);
+}
+
+/* 소비자 전용. 생산자가 연결하는 도중이면 NULL (그 생산자가 곧 다시 깨운다) */
+shard_msg *mpsc_pop(mpsc_queue *q) {
+    shard_msg *tail = q->tail;
+    shard_msg *next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (tail == &q->stub) {
+        if (!next) return NULL;
+        q->tail = tail = next;
+        next = atomic_load_explicit(&next->next, memory_order_acquire);
+    }
+    if (next) {
+        q->tail = next;
+        return tail;
+    }
+    if (tail != atomic_load_explicit(&q->head, memory_order_acquire)) return NULL;
+    mpsc_push(q, &q->stub);
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (next) {
+        q->tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+/* 이미 깨워 두었으면 eventfd를 다시 건드리지 않는다 */
+void shard_wake(shard *s) {
+    uint64_t one = 1;
+    if (atomic_exchange(&s->wake_pending, 1) == 0 && write(s->wake_fd, &one, sizeof(one)) < 0)
+        perror("shard wake");
+}
+
+/*
+ * 클라이언트 레지스트리. 끊긴 연결의 슬롯은 세대를 올려 재사용하므로, 다른 샤드에 떠 있던
+ * 방송의 제외 대상이나 늦게 도착한 통지가 같은 fd/슬롯을 받은 새 연결을 가리키지 않는다.
+ */
+int registry_add(shard *s, client_info *c) {
+    uint32_t idx;
+    if (s->client_count == s->client_cap) {
+        int ncap = s->client_cap ? s->client_cap * 2 : 64;
+        client_info **nc = realloc(s->clients, ncap * sizeof(*nc));
+        if (!nc) return -1;
+        s->clients = nc;
+        s->client_cap = ncap;
+    }
+    if (s->free_slot != UINT32_MAX) {
+        idx = s->free_slot;
+        s->free_slot = s->slots[idx].next_free;
+    } else {
+        if (s->nslots == s->slot_cap) {
+            uint32_t ncap = s->slot_cap ? s->slot_cap * 2 : 64;
+            client_slot *ns;
+            if (ncap > MAX_CLIENTS) ncap = MAX_CLIENTS; // 슬롯 번호는 16비트
+            if (s->nslots == ncap || !(ns = realloc(s->slots, ncap * sizeof(*ns)))) return -1;
+            s->slots = ns;
+            s->slot_cap = ncap;
+        }
+        idx = s->nslots++;
+        s->slots[idx].gen = 1;
+    }
+    s->slots[idx].c = c;
+    c->id = (client_handle)s->slots[idx].gen << 32 | (client_handle)s->id << 16 | idx;
+    c->pos = s->client_count;
+    s->clients[s->client_count++] = c;
+    return 0;
+}
+
+void registry_remove(shard *s, client_info *c) {
+    uint32_t idx = c->id & 0xffff;
+    client_info *last = s->clients[--s->client_count];
+    s->clients[c->pos] = last; // 마지막 것을 빈자리로
+    last->pos = c->pos;
+    s->slots[idx].c = NULL;
+    if (++s->slots[idx].gen == 0) s->slots[idx].gen = 1; // 핸들 0은 "없음"
+    s->slots[idx].next_free = s->free_slot;
+    s->free_slot = idx;
+}
+
+/* 핸들이 가리키던 연결이 아직 살아 있으면 그 클라이언트, 아니면 NULL */
+client_info *registry_get(shard *s, client_handle h) {
+    uint32_t idx = h & 0xffff;
+    if (idx >= s->nslots || s->slots[idx].gen != (uint32_t)(h >> 32)) return NULL;
+    return s->slots[idx].c;
+}
+
+/* 현재 샤드의 클라이언트에게 넣는다. 워커 스레드에서만 */
+void on_client_event(io_handler *h, uint32_t events);
+
+void shard_deliver(const shard_msg *m) {
+    shard *s = cur_shard;
+    if (m->target) { // 작업 풀 응답
+        client_info *c = registry_get(s, m->target); // 그 사이 끊겼으면 NULL
+        if (!c) return;
+        if (m->text) client_enqueue(c, m->text, m->kind);
+        c->pool_pending = 0;
+        on_client_event(&c->io, EPOLLIN); // 멈춰 둔 줄과 소켓을 이어서 처리
+        return;
+    }
+    for (int i = 0; i < s->client_count; i++) {
+        client_info *c = s->clients[i];
+        // 닉네임을 정하기 전인 클라이언트는 입장할 때 백로그로 한 번만 받는다
+        if (c->id == m->exclude || c->state != CLIENT_CHAT) continue;
+        if (m->user[0] && strcmp(c->nickname, m->user) != 0) continue;
+        if (c->binary) {
+            if (m->bin) client_enqueue(c, m->bin, m->kind);
+            continue;
+        }
+        client_enqueue(c, m->text, m->kind);
+    }
+}
+
+/* 방송 하나를 백로그에 넣고 가장 오래된 것을 내보낸다 */
+void backlog_push(msgbuf *text, msgbuf *bin, enum msg_kind kind) {
+    msgbuf *old_text, *old_bin;
+    if (backlog_size == 0) return;
+    pthread_mutex_lock(&backlog_lock);
+    backlog_entry *e = &backlog_ring[backlog_n++ % backlog_size];
+    old_text = e->text;
+    old_bin = e->bin;
+    e->text = msgbuf_ref(text);
+    e->bin = bin ? msgbuf_ref(bin) : NULL;
+    e->kind = kind;
+    pthread_mutex_unlock(&backlog_lock);
+    msgbuf_unref(old_text);
+    msgbuf_unref(old_bin);
+}
+
+/*
+ * 모든 샤드에 방송한다. 워커에서 부르면 자기 샤드는 바로 넣어 응답 순서를 지키고,
+ * 나머지 샤드에는 버퍼 참조만 담은 메시지를 보낸다. 렌더링은 부른 쪽에서 한 번뿐이다.
+ */
+void shard_broadcast(msgbuf *text, msgbuf *bin, enum msg_kind kind, client_handle exclude, const char *user) {
+    shard_msg local = { .text = text, .bin = bin, .kind = kind, .exclude = exclude, .posted_ns = now_ns() };
+    if (user) snprintf(local.user, sizeof(local.user), "%s", user);
+    else backlog_push(text, bin, kind); // 특정 사용자 공지는 남기지 않는다
+    for (int i = 0; i < shard_count; i++) {
+        shard *s = &shards[i];
+        if (s == cur_shard) {
+            shard_deliver(&local);
+            continue;
+        }
+        shard_msg *m = malloc(sizeof(shard_msg));
+        if (!m) continue;
+        *m = local;
+        msgbuf_ref(text);
+        if (bin) msgbuf_ref(bin);
+        mpsc_push(&s->inbox, m);
+        shard_wake(s);
+    }
+}
+
+/* 렌더링 방식(본인/남)별로 한 번씩만 만들고 모든 큐가 같은 버퍼를 가리킨다 */
+void broadcast_with_color(client_info *sender, const char *text) {
+    const char *nick = sender->nickname;
+    uint64_t t0 = now_ns();
+    msgbuf *mine = msgbuf_printf(COLOR_GREEN "%s: %s\n" COLOR_RESET, nick, text); // 본인: 초록
+    msgbuf *others = msgbuf_printf(COLOR_RESET "%s: %s\n" COLOR_RESET, nick, text); // 남: 흰색(기본)
+    msgbuf *bin = msgbuf_text_frame(WIRE_CHAT, nick, text); // 지금 없어도 백로그를 받을 바이너리 클라이언트용
+    if (!mine || !others || !bin) {
+        msgbuf_unref(mine);
+        msgbuf_unref(others);
+        msgbuf_unref(bin);
+        return;
+    }
+    shard_broadcast(others, bin, MSG_TEXT, sender->id, NULL);
+    // 보낸 사람은 항상 현재 샤드 소속
+    if (!sender->binary) client_enqueue(sender, mine, MSG_TEXT);
+    else if (bin) client_enqueue(sender, bin, MSG_TEXT);
+    msgbuf_unref(mine);
+    msgbuf_unref(others);
+    msgbuf_unref(bin);
+    metric_record(MH_BROADCAST, now_ns() - t0);
+}
+/* 워커가 모두 끝난 뒤 main에서 호출. 보내다 만 메시지와 압축 협상을 지키도록 평소 송신 큐로 보낸다 */
+void broadcast_shutdown() {
+    const char *shutdown_msg = COLOR_RED "[서버] 서버가 종료됩니다. 연결을 종료합니다.\n" COLOR_RESET;
+    msgbuf *text = msgbuf_printf("%s", shutdown_msg);
+    msgbuf *bin = msgbuf_text_frame(WIRE_TEXT, NULL, shutdown_msg);
+    for (int s = 0; s < shard_count; s++) {
+        for (int i = 0; i < shards[s].client_count; i++) {
+            client_info *c = shards[s].clients[i];
+            msgbuf *b = c->binary ? bin : text;
+            c->corked = 0;
+            if (b) client_enqueue(c, b, MSG_TEXT); // 밀린 큐부터 이어서 flush (막히면 거기까지)
+            close(c->sockfd);
+        }
+    }
+    msgbuf_unref(text);
+    msgbuf_unref(bin);
+}
+/* ---- 비동기 HTTP (curl_multi + epoll) ---- */
+
+void http_check_done(void) {
+    CURLMsg *msg;
+    int pending;
+    while ((msg = curl_multi_info_read(http_multi, &pending)) != NULL) {
+        if (msg->msg != CURLMSG_DONE) continue;
+        CURL *easy = msg->easy_handle;
+        CURLcode res = msg->data.result;
+        http_request *req = NULL;
+        long status = 0;
+        curl_easy_getinfo(easy, CURLINFO_PRIVATE, (char **)&req);
+        curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &status);
+        curl_multi_remove_handle(http_multi, easy);
+        req->done(req, res, status);
+        // 핸들을 보관해 두면 연결/DNS 캐시를 물고 있는 상태로 다음 요청에 재사용된다
+        if (http_idle_count < HTTP_MAX_IDLE_HANDLES) http_idle[http_idle_count++] = easy;
+        else curl_easy_cleanup(easy);
+        free(req);
+    }
+}
+
+void on_curl_sock_event(io_handler *h, uint32_t events) {
+    curl_sock *cs = (curl_sock *)h;
+    int flags = 0, running;
+    if (cs->fd < 0) return; // 이번 배치에서 이미 제거됨
+    if (events & EPOLLIN) flags |= CURL_CSELECT_IN;
+    if (events & EPOLLOUT) flags |= CURL_CSELECT_OUT;
+    if (events & (EPOLLERR | EPOLLHUP)) flags |= CURL_CSELECT_ERR;
+    curl_multi_socket_action(http_multi, cs->fd, flags, &running);
+    http_check_done();
+}
+
+void on_http_timer(io_handler *h, uint32_t events) {
+    uint64_t expirations;
+    int running;
+    (void)h; (void)events;
+    if (read(http_timerfd, &expirations, sizeof(expirations)) < 0 && errno == EAGAIN) return;
+    curl_multi_socket_action(http_multi, CURL_SOCKET_TIMEOUT, 0, &running);
+    http_check_done();
+}
+
+io_handler http_timer_handler = { on_http_timer };
+
+int http_socket_cb(CURL *easy, curl_socket_t s, int what, void *userp, void *socketp) {
+    curl_sock *cs = socketp;
+    (void)easy; (void)userp;
+    if (what == CURL_POLL_REMOVE) {
+        if (cs) {
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, s, NULL);
+            curl_multi_assign(http_multi, s, NULL);
+            cs->fd = -1;
+            cs->next_dead = http_dead_socks;
+            http_dead_socks = cs;
+        }
+        return 0;
+    }
+    // curl은 level-triggered 의미를 기대하므로 EPOLLET 없이 등록
+    struct epoll_event ev = { .events = 0 };
+    if (what & CURL_POLL_IN) ev.events |= EPOLLIN;
+    if (what & CURL_POLL_OUT) ev.events |= EPOLLOUT;
+    if (!cs) {
+        cs = calloc(1, sizeof(curl_sock));
+        if (!cs) return -1;
+        cs->io.on_event = on_curl_sock_event;
+        cs->fd = s;
+        ev.data.ptr = cs;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, s, &ev) == -1) {
+            free(cs);
+            return -1;
+        }
+        curl_multi_assign(http_multi, s, cs);
+    } else {
+        ev.data.ptr = cs;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, s, &ev);
+    }
+    return 0;
+}
+
+int http_timer_cb(CURLM *multi, long timeout_ms, void *userp) {
+    struct itimerspec its = { { 0, 0 }, { 0, 0 } };
+    (void)multi; (void)userp;
+    if (timeout_ms == 0) {
+        its.it_value.tv_nsec = 1; // 즉시
+    } else if (timeout_ms > 0) {
+        its.it_value.tv_sec = timeout_ms / 1000;
+        its.it_value.tv_nsec = (timeout_ms % 1000) * 1000000;
+    }
+    timerfd_settime(http_timerfd, 0, &its, NULL); // -1이면 모두 0이라 해제
+    return 0;
+}
+
+/* 메인 루프에서 epoll 배치 처리가 끝난 뒤 호출. 제거된 curl 소켓 핸들러를 해제 */
+void http_reap_sockets(void) {
+    while (http_dead_socks) {
+        curl_sock *cs = http_dead_socks;
+        http_dead_socks = cs->next_dead;
+        free(cs);
+    }
+}
+
+int http_init(void) {
+    http_multi = curl_multi_init();
+    if (!http_multi) return -1;
+    http_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (http_timerfd == -1) return -1;
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &http_timer_handler };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, http_timerfd, &ev) == -1) return -1;
+    curl_multi_setopt(http_multi, CURLMOPT_SOCKETFUNCTION, http_socket_cb);
+    curl_multi_setopt(http_multi, CURLMOPT_TIMERFUNCTION, http_timer_cb);
+    curl_multi_setopt(http_multi, CURLMOPT_MAXCONNECTS, (long)HTTP_MAX_IDLE_HANDLES);
+    return 0;
+}
+
+void http_cleanup(void) {
+    // 진행 중인 요청은 콜백 없이 버린다
+    for (int i = 0; i < http_idle_count; i++) curl_easy_cleanup(http_idle[i]);
+    http_idle_count = 0;
+    if (http_multi) curl_multi_cleanup(http_multi);
+    http_multi = NULL;
+    http_reap_sockets();
+    if (http_timerfd != -1) close(http_timerfd);
+}
+
+/* 비동기 GET. 완료되면 메인 루프에서 done이 불린다. 시작 실패 시 NULL */
+http_request *http_get(const char *url, long timeout_ms, http_data_fn on_data, http_done_fn done, void *user) {
+    http_request *req = calloc(1, sizeof(http_request));
+    if (!req) return NULL;
+    CURL *easy = http_idle_count > 0 ? http_idle[--http_idle_count] : curl_easy_init();
+    if (!easy) {
+        free(req);
+        return NULL;
+    }
+    req->easy = easy;
+    req->on_data = on_data;
+    req->done = done;
+    req->user = user;
+    curl_easy_setopt(easy, CURLOPT_URL, url);
+    curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, write_callback);
+    curl_easy_setopt(easy, CURLOPT_WRITEDATA, req);
+    curl_easy_setopt(easy, CURLOPT_PRIVATE, req);
+    curl_easy_setopt(easy, CURLOPT_TIMEOUT_MS, timeout_ms);
+    curl_easy_setopt(easy, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(easy, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(easy, CURLOPT_DNS_CACHE_TIMEOUT, 600L);
+    if (curl_multi_add_handle(http_multi, easy) != CURLM_OK) {
+        curl_easy_cleanup(easy);
+        free(req);
+        return NULL;
+    }
+    return req;
+}
+
+/* 스냅샷 참조를 하나 얻는다. 없으면 NULL. 사용 후 forecast_put() */
+forecast_snapshot *forecast_get(void) {
+    pthread_mutex_lock(&forecast_lock);
+    forecast_snapshot *snap = forecast_cur;
+    if (snap) atomic_fetch_add_explicit(&snap->refs, 1, memory_order_relaxed);
+    pthread_mutex_unlock(&forecast_lock);
+    return snap;
+}
+
+void forecast_put(forecast_snapshot *snap) {
+    if (snap && atomic_fetch_sub_explicit(&snap->refs, 1, memory_order_acq_rel) == 1) {
+        msgbuf_unref(snap->msg);
+        msgbuf_unref(snap->bin);
+        free(snap);
+    }
+}
+
+void forecast_publish(forecast_snapshot *snap) {
+    pthread_mutex_lock(&forecast_lock);
+    forecast_snapshot *old = forecast_cur;
+    forecast_cur = snap;
+    atomic_fetch_add(&forecast_gen, 1);
+    pthread_mutex_unlock(&forecast_lock);
+    forecast_put(old);
+}
+
+/* 현재 시각 기준 base_time의 캐시가 없으면 1 */
+int forecast_stale(const forecast_snapshot *snap) {
+    char base_date[9], base_time[5];
+    if (!snap || !snap->ok) return 1;
+    get_kma_date_time(base_date, base_time);
+    return strcmp(snap->base_date, base_date) != 0 || strcmp(snap->base_time, base_time) != 0;
+}
+
+/* 다음 발표 시각(base_time + KMA_PUBLISH_DELAY)까지 남은 초 */
+int seconds_until_next_publish(void) {
+    static const int base_h[] = {2,5,8,11,14,17,20,23};
+    time_t now = time(NULL);
+    struct tm tmbuf, *tm = localtime_r(&now, &tmbuf);
+    int now_sec = tm->tm_hour * 3600 + tm->tm_min * 60 + tm->tm_sec;
+    for (int i = 0; i < 8; i++) {
+        int at = base_h[i] * 3600 + 30 * 60 + KMA_PUBLISH_DELAY;
+        if (at > now_sec) return at - now_sec;
+    }
+    return 24 * 3600 - now_sec + base_h[0] * 3600 + 30 * 60 + KMA_PUBLISH_DELAY;
+}
+
+void forecast_schedule(int sec) {
+    struct itimerspec its = { { 0, 0 }, { sec, sec == 0 ? 1 : 0 } };
+    timerfd_settime(forecast_timerfd, 0, &its, NULL);
+}
+
+void on_forecast_data(http_request *req, const char *data, size_t len) {
+    (void)req;
+    kma_parser_feed(&forecast_parser, data, len);
+}
+
+void on_forecast_done(http_request *req, CURLcode res, long status) {
+    char reply[BUF_SIZE];
+    int ok;
+    (void)req; (void)status;
+    forecast_inflight = 0;
+    metric_record(MH_KMA_FETCH, now_ns() - forecast_req_ns);
+    if (res != CURLE_OK) {
+        snprintf(reply, sizeof(reply), COLOR_YELLOW "[서버] 기상청 API 요청 실패: %s\n" COLOR_RESET, curl_easy_strerror(res));
+        ok = 0;
+    } else {
+        ok = kma_render_weather(&forecast_req_table, forecast_req_time, reply, sizeof(reply)) == 0;
+    }
+    printf(COLOR_CYAN "%s" COLOR_RESET, reply);
+
+    forecast_snapshot *cur = forecast_get();
+    // 성공한 캐시는 오류로 덮어쓰지 않는다
+    if (ok || !cur || !cur->ok) {
+        forecast_snapshot *snap = calloc(1, sizeof(forecast_snapshot));
+        if (snap) {
+            atomic_init(&snap->refs, 1);
+            snprintf(snap->base_date, sizeof(snap->base_date), "%s", forecast_req_date);
+            snprintf(snap->base_time, sizeof(snap->base_time), "%s", forecast_req_time);
+            snap->nx = KMA_NX;
+            snap->ny = KMA_NY;
+            snap->ok = ok;
+            snap->table = forecast_req_table;
+            snap->msg = msgbuf_printf("%s", reply);
+            snap->bin = ok ? msgbuf_forecast_frame(&snap->table, snap->base_date, snap->base_time)
+                           : msgbuf_text_frame(WIRE_TEXT, NULL, reply);
+            if (snap->msg && snap->bin) {
+                forecast_publish(snap);
+            } else {
+                msgbuf_unref(snap->msg);
+                msgbuf_unref(snap->bin);
+                free(snap);
+            }
+        }
+    }
+    forecast_put(cur);
+
+    if (!ok) metric_add(MC_KMA_FAILURES, 1);
+    if (ok) {
+        forecast_failures = 0;
+        forecast_schedule(seconds_until_next_publish() + rand_r(&forecast_seed) % 60);
+    } else {
+        // 지터를 섞은 지수 백오프
+        int backoff = KMA_RETRY_MIN << (forecast_failures < 6 ? forecast_failures : 6);
+        if (backoff > KMA_RETRY_MAX) backoff = KMA_RETRY_MAX;
+        forecast_schedule(backoff / 2 + rand_r(&forecast_seed) % (backoff / 2 + 1));
+        forecast_failures++;
+    }
+}
+
+/* 예보 요청을 시작한다. 이미 진행 중이면 그 결과를 같이 쓴다 (single-flight) */
+void forecast_start(void) {
+    char url[1024];
+    if (forecast_inflight) return;
+    get_kma_date_time(forecast_req_date, forecast_req_time);
+    kma_build_url(forecast_req_date, forecast_req_time, url, sizeof(url));
+    kma_parser_init(&forecast_parser, &forecast_req_table);
+    if (http_get(url, KMA_TIMEOUT_MS, on_forecast_data, on_forecast_done, NULL) == NULL) {
+        printf(COLOR_YELLOW "[서버] 기상청 API 초기화 실패\n" COLOR_RESET);
+        forecast_schedule(KMA_RETRY_MAX);
+        return;
+    }
+    forecast_inflight = 1;
+    forecast_req_ns = now_ns();
+    metric_add(MC_KMA_FETCHES, 1);
+}
+
+/* 캐시 미스 시 워커에서 호출. 갱신 상태는 건드리지 않고 메인 루프만 깨운다 */
+void forecast_kick(void) {
+    uint64_t one = 1;
+    if (write(forecast_kickfd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        perror("forecast kick write");
+}
+
+/* 동시에 여러 번 불려도 eventfd 값이 합쳐져 한 번만 처리되고, 진행 중이거나 백오프 중이면 무시 */
+void on_forecast_kick(io_handler *h, uint32_t events) {
+    uint64_t n;
+    (void)h; (void)events;
+    if (read(forecast_kickfd, &n, sizeof(n)) < 0) return;
+    if (!forecast_inflight && forecast_failures == 0) forecast_schedule(0);
+}
+
+void on_forecast_timer(io_handler *h, uint32_t events) {
+    uint64_t expirations;
+    (void)h; (void)events;
+    if (read(forecast_timerfd, &expirations, sizeof(expirations)) < 0 && errno == EAGAIN) return;
+    forecast_snapshot *cur = forecast_get();
+    int need = forecast_stale(cur);
+    forecast_put(cur);
+    if (need) forecast_start();
+    else forecast_schedule(seconds_until_next_publish() + rand_r(&forecast_seed) % 60);
+}
+
+io_handler forecast_timer_handler = { on_forecast_timer };
+io_handler forecast_kick_handler = { on_forecast_kick };
+
+void sensor_publish(const sensor_sample *smp) {
+    unsigned int seq = atomic_load_explicit(&sensor_seq, memory_order_relaxed);
+    atomic_store_explicit(&sensor_seq, seq + 1, memory_order_relaxed); // 홀수: 쓰는 중
+    atomic_thread_fence(memory_order_release);
+    sensor_latest = *smp;
+    atomic_store_explicit(&sensor_seq, seq + 2, memory_order_release);
+}
+
+/* 최신 샘플을 복사해 온다. 장치를 건드리지 않으므로 비용이 일정하다 */
+void sensor_snapshot(sensor_sample *out) {
+    unsigned int s1, s2;
+    do {
+        s1 = atomic_load_explicit(&sensor_seq, memory_order_acquire);
+        *out = sensor_latest;
+        atomic_thread_fence(memory_order_acquire);
+        s2 = atomic_load_explicit(&sensor_seq, memory_order_relaxed);
+    } while ((s1 & 1) || s1 != s2);
+}
+
+int history_init(void) {
+    static const struct { int period, cap, window; } spec[HIST_LEVELS] = {
+        [HIST_1S] = { 1, 3600, 60 },   // 1시간 보관, 1m 조회
+        [HIST_1M] = { 60, 1440, 60 },  // 하루 보관, 1h 조회
+        [HIST_1H] = { 3600, 720, 24 }, // 30일 보관, 24h 조회
+    };
+    for (int m = 0; m < HIST_COUNT; m++) {
+        for (int l = 0; l < HIST_LEVELS; l++) {
+            hist_level *lv = &history[m][l];
+            lv->period = spec[l].period;
+            lv->cap = spec[l].cap;
+            lv->window = spec[l].window;
+            lv->ring = calloc(lv->cap, sizeof(hist_bucket));
+            if (!lv->ring) return -1;
+        }
+    }
+    return 0;
+}
+
+void history_cleanup(void) {
+    for (int m = 0; m < HIST_COUNT; m++)
+        for (int l = 0; l < HIST_LEVELS; l++)
+            free(history[m][l].ring);
+}
+
+/* 진행 중 버킷을 링에 확정하고 이동 집계에 넣는다 */
+void hist_commit(hist_level *lv) {
+    unsigned long id = lv->n++;
+    hist_bucket *b = &lv->ring[id % lv->cap];
+    *b = lv->cur;
+    lv->wsum += b->sum;
+    lv->wcount += b->count;
+
+    while (lv->min_len > 0 &&
+           lv->ring[lv->dq_min[(lv->min_head + lv->min_len - 1) % HIST_WIN_MAX] % lv->cap].min >= b->min)
+        lv->min_len--;
+    lv->dq_min[(lv->min_head + lv->min_len++) % HIST_WIN_MAX] = id;
+    while (lv->max_len > 0 &&
+           lv->ring[lv->dq_max[(lv->max_head + lv->max_len - 1) % HIST_WIN_MAX] % lv->cap].max <= b->max)
+        lv->max_len--;
+    lv->dq_max[(lv->max_head + lv->max_len++) % HIST_WIN_MAX] = id;
+}
+
+/* 창 밖으로 밀려난 버킷을 집계에서 뺀다. 창에는 버킷이 최대 window-1개만 남는다 */
+void hist_evict(hist_level *lv) {
+    time_t limit = lv->cur.start - (time_t)lv->window * lv->period;
+    while (lv->wfirst < lv->n &&
+           (lv->ring[lv->wfirst % lv->cap].start <= limit || lv->n - lv->wfirst >= (unsigned long)lv->window)) {
+        hist_bucket *b = &lv->ring[lv->wfirst % lv->cap];
+        lv->wsum -= b->sum;
+        lv->wcount -= b->count;
+        lv->wfirst++;
+    }
+    while (lv->min_len > 0 && lv->dq_min[lv->min_head] < lv->wfirst) {
+        lv->min_head = (lv->min_head + 1) % HIST_WIN_MAX;
+        lv->min_len--;
+    }
+    while (lv->max_len > 0 && lv->dq_max[lv->max_head] < lv->wfirst) {
+        lv->max_head = (lv->max_head + 1) % HIST_WIN_MAX;
+        lv->max_len--;
+    }
+    if (lv->wcount == 0) lv->wsum = 0; // 부동소수 오차가 쌓이지 않게
+}
+
+/* 샘플 하나(혹은 실패한 주기)를 반영한다. 실패해도 시간은 흘러 창이 밀려난다 */
+void hist_add(hist_level *lv, time_t t, int valid, float v) {
+    time_t start = t - t % lv->period;
+    if (start != lv->cur.start) {
+        if (lv->cur.count > 0) hist_commit(lv);
+        lv->cur = (hist_bucket){ .start = start };
+        hist_evict(lv);
+    }
+    if (!valid) return;
+    if (lv->cur.count == 0 || v < lv->cur.min) lv->cur.min = v;
+    if (lv->cur.count == 0 || v > lv->cur.max) lv->cur.max = v;
+    lv->cur.sum += v;
+    lv->cur.count++;
+}
+
+/* sensor_monitor에서 샘플을 발행할 때마다 호출 */
+void history_record(const sensor_sample *smp) {
+    hist_raw r = { .ts = smp->ts.tv_sec };
+    if (smp->temp_state == SENSOR_OK) {
+        r.valid |= 1 << HIST_TEMP | 1 << HIST_PRESSURE;
+        r.v[HIST_TEMP] = smp->temp;
+        r.v[HIST_PRESSURE] = smp->pressure / 100.0f; // hPa
+    }
+    if (smp->lux_state == SENSOR_OK) {
+        r.valid |= 1 << HIST_LUX;
+        r.v[HIST_LUX] = smp->lux;
+    }
+
+    pthread_mutex_lock(&history_lock);
+    hist_raw_ring[hist_raw_n++ % HIST_RAW_SAMPLES] = r;
+    for (int m = 0; m < HIST_COUNT; m++)
+        for (int l = 0; l < HIST_LEVELS; l++)
+            hist_add(&history[m][l], r.ts, r.valid & (1 << m), r.v[m]);
+    pthread_mutex_unlock(&history_lock);
+}
+
+/* 창 크기와 무관하게 O(1): 이동 집계 + 진행 중 버킷 */
+int history_query(enum hist_metric m, int level, hist_bucket *out) {
+    pthread_mutex_lock(&history_lock);
+    const hist_level *lv = &history[m][level];
+    out->count = lv->wcount + lv->cur.count;
+    out->sum = lv->wsum + lv->cur.sum;
+    if (out->count > 0) {
+        out->min = lv->cur.count ? lv->cur.min : INFINITY;
+        out->max = lv->cur.count ? lv->cur.max : -INFINITY;
+        if (lv->min_len > 0 && lv->ring[lv->dq_min[lv->min_head] % lv->cap].min < out->min)
+            out->min = lv->ring[lv->dq_min[lv->min_head] % lv->cap].min;
+        if (lv->max_len > 0 && lv->ring[lv->dq_max[lv->max_head] % lv->cap].max > out->max)
+            out->max = lv->ring[lv->dq_max[lv->max_head] % lv->cap].max;
+    }
+    pthread_mutex_unlock(&history_lock);
+    return out->count > 0 ? 0 : -1;
+}
+
+uint64_t store_checksum(const store_block *b) {
+    const unsigned char *p = (const unsigned char *)b;
+    uint64_t h = 1469598103934665603ULL; // FNV-1a
+    for (size_t i = 0; i < offsetof(store_block, checksum); i++)
+        h = (h ^ p[i]) * 1099511628211ULL;
+    return h;
+}
+
+int store_map(store_seg *s, int fd, int writable) {
+    s->map = mmap(NULL, STORE_SEG_BYTES, PROT_READ | (writable ? PROT_WRITE : 0), MAP_SHARED, fd, 0);
+    if (s->map == MAP_FAILED) return -1;
+    s->hdr = (store_seg_hdr *)s->map;
+    s->blk = (store_block *)(s->map + sizeof(store_seg_hdr));
+    s->data = (store_data *)(s->map + STORE_DATA_OFF);
+    return 0;
+}
+
+/* 새 세그먼트를 만들어 목록 끝에 붙인다 */
+int store_new_segment(void) {
+    char path[PATH_MAX];
+    unsigned id = store_nsegs ? store_segs[store_nsegs - 1].id + 1 : 0;
+    store_seg *segs = realloc(store_segs, (store_nsegs + 1) * sizeof(store_seg));
+    if (!segs) return -1;
+    store_segs = segs;
+
+    // 같은 번호가 남아 있으면 (열 수 없어 건너뛴 파일) 덮어쓰지 않고 다음 번호로
+    int fd;
+    do {
+        snprintf(path, sizeof(path), "%s/seg-%06u.wsd", store_dir, id++);
+        fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    } while (fd < 0 && errno == EEXIST);
+    if (fd < 0) return -1;
+    id--;
+    store_seg *s = &store_segs[store_nsegs];
+    s->id = id;
+    if (ftruncate(fd, STORE_SEG_BYTES) == -1 || store_map(s, fd, 1) == -1) {
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+    close(fd);
+    s->hdr->version = STORE_VERSION;
+    memcpy(s->hdr->magic, STORE_MAGIC, sizeof(s->hdr->magic));
+    store_nsegs++;
+    return 0;
+}
+
+/* 열린 블록의 통계를 데이터에서 다시 계산한다. 단조 증가가 깨진 곳부터는 버린다 */
+void store_rebuild_block(store_block *b, const store_data *d) {
+    uint32_t n = b->count > STORE_BLOCK_SAMPLES ? STORE_BLOCK_SAMPLES : b->count;
+    for (uint32_t i = 1; i < n; i++) {
+        if (d->ts[i] < d->ts[i - 1]) {
+            n = i;
+            break;
+        }
+    }
+    b->count = n;
+    b->last_ms = n ? b->base_ms + d->ts[n - 1] : 0;
+    for (int c = 0; c < HIST_COUNT; c++) {
+        b->nvalid[c] = 0;
+        b->sum[c] = 0;
+        for (uint32_t i = 0; i < n; i++) {
+            if (d->col[c][i] == STORE_MISSING) continue;
+            int32_t v = b->base[c] + d->col[c][i];
+            if (b->nvalid[c] == 0 || v < b->min[c]) b->min[c] = v;
+            if (b->nvalid[c] == 0 || v > b->max[c]) b->max[c] = v;
+            b->sum[c] += v;
+            b->nvalid[c]++;
+        }
+    }
+}
+
+/* 마지막 세그먼트만 검사한다. 앞쪽 세그먼트는 닫힐 때 이미 확정됐다 */
+void store_recover_tail(store_seg *s) {
+    if (memcmp(s->hdr->magic, STORE_MAGIC, sizeof(s->hdr->magic)) != 0) {
+        // 헤더를 쓰기 전에 죽은 세그먼트
+        memset(s->hdr, 0, sizeof(*s->hdr));
+        memset(s->blk, 0, sizeof(store_block));
+        s->hdr->version = STORE_VERSION;
+        memcpy(s->hdr->magic, STORE_MAGIC, sizeof(s->hdr->magic));
+        return;
+    }
+    if (s->hdr->nblocks > STORE_SEG_BLOCKS) s->hdr->nblocks = STORE_SEG_BLOCKS;
+    for (uint32_t i = 0; i < s->hdr->nblocks; i++) {
+        if (s->blk[i].checksum != store_checksum(&s->blk[i])) {
+            fprintf(stderr, "[서버] 저장소 세그먼트 %u: 블록 %u 손상, 이후를 버립니다\n", s->id, i);
+            s->hdr->nblocks = i;
+            break;
+        }
+    }
+    if (s->hdr->nblocks == STORE_SEG_BLOCKS) {
+        s->hdr->sealed = 1;
+        return;
+    }
+    s->hdr->sealed = 0;
+    store_rebuild_block(&s->blk[s->hdr->nblocks], &s->data[s->hdr->nblocks]);
+}
+
+int store_filter(const struct dirent *d) {
+    unsigned id;
+    char end;
+    return sscanf(d->d_name, "seg-%u.wsd%c", &id, &end) == 1;
+}
+
+void store_close(void);
+
+int store_open(const char *dir) {
+    struct dirent **names;
+    store_dir = dir;
+    if (mkdir(dir, 0755) == -1 && errno != EEXIST) return -1;
+    int n = scandir(dir, &names, store_filter, alphasort);
+    if (n < 0) return -1;
+    for (int i = 0; i < n; i++) {
+        char path[PATH_MAX];
+        struct stat st;
+        store_seg s;
+        snprintf(path, sizeof(path), "%s/%s", dir, names[i]->d_name);
+        sscanf(names[i]->d_name, "seg-%u", &s.id);
+        free(names[i]);
+        int fd = open(path, O_RDWR | O_CLOEXEC);
+        // 가장 최근 세그먼트가 덜 만들어졌으면 (O_EXCL 생성 후 ftruncate 전에 죽음) 크기를 채워 다시 쓴다.
+        // 헤더가 비어 있으니 store_recover_tail이 새 세그먼트로 초기화한다
+        if (fd >= 0 && i == n - 1 && fstat(fd, &st) == 0 && st.st_size < (off_t)STORE_SEG_BYTES) {
+            fprintf(stderr, "[서버] 저장소 세그먼트 %s: 생성 중 중단된 파일을 다시 초기화합니다\n", path);
+            if (ftruncate(fd, 0) == -1 || ftruncate(fd, STORE_SEG_BYTES) == -1) perror("ftruncate");
+        }
+        // 일단 모두 읽기 전용으로 매핑하고, 꼬리가 정해진 뒤에 그것만 쓰기 가능으로 바꾼다
+        if (fd < 0 || fstat(fd, &st) == -1 || st.st_size != (off_t)STORE_SEG_BYTES ||
+            store_map(&s, fd, 0) == -1) {
+            fprintf(stderr, "[서버] 저장소 세그먼트 %s를 건너뜁니다\n", path);
+            if (fd >= 0) close(fd);
+            continue;
+        }
+        close(fd);
+        store_seg *segs = realloc(store_segs, (store_nsegs + 1) * sizeof(store_seg));
+        if (!segs) {
+            munmap(s.map, STORE_SEG_BYTES);
+            continue;
+        }
+        store_segs = segs;
+        store_segs[store_nsegs++] = s;
+    }
+    free(names);
+
+    if (store_nsegs > 0) {
+        store_seg *tail = &store_segs[store_nsegs - 1];
+        if (mprotect(tail->map, STORE_SEG_BYTES, PROT_READ | PROT_WRITE) == -1) {
+            perror("저장소 세그먼트 mprotect");
+            store_close();
+            return -1;
+        }
+        store_recover_tail(tail);
+    }
+    if (store_nsegs == 0 || store_segs[store_nsegs - 1].hdr->sealed)
+        return store_new_segment();
+    return 0;
+}
+
+void store_close(void) {
+    for (int i = 0; i < store_nsegs; i++) {
+        if (i == store_nsegs - 1) msync(store_segs[i].map, STORE_SEG_BYTES, MS_SYNC);
+        munmap(store_segs[i].map, STORE_SEG_BYTES);
+    }
+    free(store_segs);
+    store_segs = NULL;
+    store_nsegs = 0;
+}
+
+/* 열린 블록에 샘플이 더 들어갈 수 있는지: 개수, 시각 역행, 오프셋 범위 */
+int store_fits(const store_block *b, uint64_t t, const int *valid, const int32_t *v) {
+    if (b->count == 0) return 1;
+    if (b->count >= STORE_BLOCK_SAMPLES || t < b->last_ms || t - b->base_ms > UINT32_MAX)
+        return 0;
+    for (int c = 0; c < HIST_COUNT; c++) {
+        if (valid[c] && b->nvalid[c] > 0 && (v[c] - b->base[c] > INT16_MAX || v[c] - b->base[c] <= INT16_MIN))
+            return 0;
+    }
+    return 1;
+}
+
+/* sensor_monitor에서 호출. 블록이 차면 닫고, 세그먼트가 차면 새로 만든다 */
+void store_append(const sensor_sample *smp) {
+    if (!store_dir) return;
+    uint64_t t = (uint64_t)smp->ts.tv_sec * 1000 + smp->ts.tv_nsec / 1000000;
+    int valid[HIST_COUNT] = {
+        smp->temp_state == SENSOR_OK, smp->temp_state == SENSOR_OK, smp->lux_state == SENSOR_OK
+    };
+    int32_t v[HIST_COUNT] = { (int32_t)(smp->temp * 10 + (smp->temp < 0 ? -0.5f : 0.5f)), smp->pressure, smp->lux };
+
+    pthread_mutex_lock(&store_lock);
+    store_seg *s = &store_segs[store_nsegs - 1];
+    store_block *b = &s->blk[s->hdr->nblocks];
+    if (!store_fits(b, t, valid, v)) {
+        b->checksum = store_checksum(b);
+        s->hdr->nblocks++;
+        if (s->hdr->nblocks == STORE_SEG_BLOCKS) {
+            s->hdr->sealed = 1;
+            msync(s->map, STORE_SEG_BYTES, MS_ASYNC);
+            if (store_new_segment() == -1) {
+                perror("저장소 세그먼트 생성 실패");
+                store_dir = NULL; // 더 이상 저장하지 않는다
+                pthread_mutex_unlock(&store_lock);
+                return;
+            }
+            s = &store_segs[store_nsegs - 1];
+        }
+        b = &s->blk[s->hdr->nblocks];
+        memset(b, 0, sizeof(*b));
+    }
+
+    store_data *d = &s->data[s->hdr->nblocks];
+    uint32_t n = b->count;
+    if (n == 0) b->base_ms = t;
+    d->ts[n] = t - b->base_ms;
+    for (int c = 0; c < HIST_COUNT; c++) {
+        if (!valid[c]) {
+            d->col[c][n] = STORE_MISSING;
+            continue;
+        }
+        if (b->nvalid[c] == 0) {
+            b->base[c] = b->min[c] = b->max[c] = v[c];
+        } else {
+            if (v[c] < b->min[c]) b->min[c] = v[c];
+            if (v[c] > b->max[c]) b->max[c] = v[c];
+        }
+        d->col[c][n] = v[c] - b->base[c];
+        b->sum[c] += v[c];
+        b->nvalid[c]++;
+    }
+    b->last_ms = t;
+    b->count = n + 1; // 커밋
+    pthread_mutex_unlock(&store_lock);
+}
+
+/* 값 컬럼 [lo, hi)를 8개씩 벡터로 훑는다. GCC 벡터 확장이라 NEON/SSE 어느 쪽으로도 내려간다 */
+void store_scan(const int16_t *col, uint32_t lo, uint32_t hi, int32_t base, int32_t thr, store_agg *a) {
+    typedef int16_t v8i16 __attribute__((vector_size(16)));
+    typedef int32_t v8i32 __attribute__((vector_size(32)));
+    int32_t t = thr - base;
+    int16_t thr16 = t > INT16_MAX ? INT16_MAX : t < INT16_MIN ? INT16_MIN : t;
+    const v8i16 zero = { 0 }, missing = zero + STORE_MISSING, vthr = zero + thr16;
+    v8i16 vmin = zero + INT16_MAX, vmax = missing, vcnt = zero, vabove = zero;
+    v8i32 vsum = { 0 };
+    uint32_t i = lo;
+
+    for (; i + 8 <= hi; i += 8) {
+        v8i16 x;
+        memcpy(&x, col + i, sizeof(x));
+        v8i16 ok = x != missing;
+        v8i16 lt = (x < vmin) & ok, gt = (x > vmax) & ok;
+        vmin = (x & lt) | (vmin & ~lt);
+        vmax = (x & gt) | (vmax & ~gt);
+        vsum += __builtin_convertvector(x & ok, v8i32);
+        vcnt -= ok;
+        vabove -= (x > vthr) & ok;
+    }
+
+    int32_t mn = INT16_MAX, mx = INT16_MIN;
+    int64_t sum = 0;
+    uint32_t cnt = 0, above = 0;
+    for (int k = 0; k < 8; k++) {
+        if (vmin[k] < mn) mn = vmin[k];
+        if (vmax[k] > mx) mx = vmax[k];
+        sum += vsum[k];
+        cnt += (uint16_t)vcnt[k];
+        above += (uint16_t)vabove[k];
+    }
+    for (; i < hi; i++) {
+        int16_t x = col[i];
+        if (x == STORE_MISSING) continue;
+        if (x < mn) mn = x;
+        if (x > mx) mx = x;
+        sum += x;
+        cnt++;
+        above += x > thr16;
+    }
+    if (cnt == 0) return;
+    if (a->count == 0 || base + mn < a->min) a->min = base + mn;
+    if (a->count == 0 || base + mx > a->max) a->max = base + mx;
+    a->sum += sum + (int64_t)base * cnt;
+    a->count += cnt;
+    a->above += above;
+}
+
+/* 블록 안에서 절대 시각 t 이상인 첫 위치 */
+uint32_t store_lower_bound(const store_block *b, const store_data *d, uint64_t t) {
+    uint32_t lo = 0, hi = b->count;
+    if (t <= b->base_ms) return 0;
+    uint64_t off = t - b->base_ms;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (d->ts[mid] < off) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/* 블록 하나를 a에 더한다. 구간에 통째로 든 블록은 색인만, 걸친 블록만 데이터를 읽는다.
+ * thr 초과 개수도 색인의 min/max로 블록을 먼저 걸러 낸다 */
+void store_query_block(const store_block *b, const store_data *d, enum hist_metric m,
+                       uint64_t from_ms, uint64_t to_ms, int32_t thr, store_agg *a) {
+    if (b->count == 0 || b->last_ms < from_ms || b->base_ms > to_ms || b->nvalid[m] == 0)
+        return;
+    if (b->base_ms >= from_ms && b->last_ms <= to_ms) {
+        if (a->count == 0 || b->min[m] < a->min) a->min = b->min[m];
+        if (a->count == 0 || b->max[m] > a->max) a->max = b->max[m];
+        a->sum += b->sum[m];
+        a->count += b->nvalid[m];
+        if (b->min[m] > thr) {
+            a->above += b->nvalid[m];
+        } else if (b->max[m] > thr) {
+            store_agg part = { 0 };
+            store_scan(d->col[m], 0, b->count, b->base[m], thr, &part);
+            a->above += part.above;
+        }
+    } else {
+        uint32_t lo = store_lower_bound(b, d, from_ms);
+        uint32_t hi = store_lower_bound(b, d, to_ms + 1);
+        store_scan(d->col[m], lo, hi, b->base[m], thr, a);
+    }
+}
+
+/* [from_ms, to_ms] 구간의 집계. 닫힌 블록은 다시 쓰이지 않고 매핑도 종료 때까지 그대로이므로
+ * 세그먼트 목록과 열린 블록 위치만 잠금 안에서 떠 두고 훑기는 잠금 밖에서 한다.
+ * 센서 스레드가 계속 쓰는 열린 블록 하나만 다시 잠그고 읽는다 */
+int store_query(enum hist_metric m, uint64_t from_ms, uint64_t to_ms, int32_t thr, store_agg *a) {
+    memset(a, 0, sizeof(*a));
+    pthread_mutex_lock(&store_lock);
+    if (!store_dir) {
+        pthread_mutex_unlock(&store_lock);
+        return -1;
+    }
+    int nsegs = store_nsegs;
+    store_seg *segs = malloc(nsegs * sizeof(store_seg)); // store_new_segment가 realloc할 수 있다
+    if (!segs) {
+        pthread_mutex_unlock(&store_lock);
+        return -1;
+    }
+    memcpy(segs, store_segs, nsegs * sizeof(store_seg));
+    uint32_t open_blk = segs[nsegs - 1].hdr->nblocks; // 꼬리 세그먼트에서 이보다 앞은 닫힌 블록
+    pthread_mutex_unlock(&store_lock);
+
+    for (int si = 0; si < nsegs; si++) {
+        const store_seg *s = &segs[si];
+        uint32_t nb = si == nsegs - 1 ? open_blk : s->hdr->nblocks;
+        if (nb == 0 || s->blk[0].base_ms > to_ms) continue;
+        for (uint32_t bi = 0; bi < nb; bi++)
+            store_query_block(&s->blk[bi], &s->data[bi], m, from_ms, to_ms, thr, a);
+    }
+    if (open_blk < STORE_SEG_BLOCKS) {
+        const store_seg *s = &segs[nsegs - 1];
+        pthread_mutex_lock(&store_lock);
+        store_query_block(&s->blk[open_blk], &s->data[open_blk], m, from_ms, to_ms, thr, a);
+        pthread_mutex_unlock(&store_lock);
+    }
+    free(segs);
+    return 0;
+}
+
+/* 항 하나를 파싱한다: <신호><연산자><값>[~<폭>] */
+int rule_parse_term(const char *tok, rule_term *t) {
+    static const char *ops[] = { ">=", ">", "<=", "<" };
+    int s, o;
+    size_t n;
+    for (s = 0; s < HIST_COUNT; s++) {
+        n = strlen(hist_metric_names[s]);
+        if (strncmp(tok, hist_metric_names[s], n) == 0) break;
+    }
+    if (s == HIST_COUNT) return -1;
+    tok += n;
+    for (o = 0; o < 4 && strncmp(tok, ops[o], strlen(ops[o])) != 0; o++);
+    if (o == 4) return -1;
+    tok += strlen(ops[o]);
+
+    char *end;
+    float thr = strtof(tok, &end), hyst = 0;
+    if (end == tok) return -1;
+    if (*end == '~') {
+        tok = end + 1;
+        hyst = strtof(tok, &end);
+        if (end == tok || hyst < 0) return -1;
+    }
+    if (*end != '\0') return -1;
+
+    t->sig = s;
+    t->op = o;
+    t->enter = thr;
+    t->leave = (o == RULE_GE || o == RULE_GT) ? thr - hyst : thr + hyst;
+    t->on = 0;
+    return 0;
+}
+
+/* 규칙 한 줄을 파싱해 rules[]에 붙이고 항은 terms[]에 쌓는다 */
+int rule_parse_line(char *line, rule_term **terms, int *nterms, int *cap) {
+    char *msg = strchr(line, '|');
+    if (!msg) return -1;
+    *msg++ = '\0';
+    while (*msg == ' ' || *msg == '\t') msg++;
+    msg[strcspn(msg, "\r\n")] = '\0';
+
+    rule r = { .active_pos = -1, .last_fired = 0 };
+    char *save, *tok = strtok_r(line, " \t", &save);
+    if (!tok) return -1;
+    snprintf(r.name, sizeof(r.name), "%s", tok);
+    while ((tok = strtok_r(NULL, " \t", &save))) {
+        if (strncmp(tok, "for=", 4) == 0) {
+            r.for_sec = atoi(tok + 4);
+        } else if (strncmp(tok, "cooldown=", 9) == 0) {
+            r.cooldown = atoi(tok + 9);
+        } else if (strncmp(tok, "user=", 5) == 0) {
+            snprintf(r.user, sizeof(r.user), "%s", tok + 5);
+        } else if (strcmp(tok, "once") == 0) {
+            r.once = 1;
+        } else {
+            if (*nterms == *cap) {
+                int ncap = *cap ? *cap * 2 : 64;
+                rule_term *nt = realloc(*terms, ncap * sizeof(rule_term));
+                if (!nt) return -1;
+                *terms = nt;
+                *cap = ncap;
+            }
+            rule_term *t = &(*terms)[*nterms];
+            if (rule_parse_term(tok, t) < 0) return -1;
+            t->rule = rule_count;
+            (*nterms)++;
+            r.nterms++;
+        }
+    }
+    if (r.nterms == 0 || r.for_sec < 0 || r.cooldown < 0) return -1;
+
+    rule *nr = realloc(rules, (rule_count + 1) * sizeof(rule));
+    if (!nr || !(r.msg = strdup(msg))) return -1;
+    rules = nr;
+    rules[rule_count++] = r;
+    return 0;
+}
+
+/* 규칙을 읽어 신호별로 정렬된 항 표를 만든다 */
+int rules_load(const char *path) {
+    FILE *fp = path ? fopen(path, "r") : fmemopen((void *)default_rules, sizeof(default_rules) - 1, "r");
+    if (!fp) {
+        perror(path);
+        return -1;
+    }
+    rule_term *terms = NULL;
+    int nterms = 0, cap = 0, lineno = 0, ret = 0;
+    char line[1024];
+    while (fgets(line, sizeof(line), fp)) {
+        lineno++;
+        char *p = line + strspn(line, " \t");
+        if (*p == '#' || *p == '\n' || *p == '\0') continue;
+        if (rule_parse_line(p, &terms, &nterms, &cap) < 0) {
+            fprintf(stderr, "[서버] 규칙 %s:%d: 해석할 수 없습니다\n", path ? path : "(기본)", lineno);
+            ret = -1;
+            break;
+        }
+    }
+    fclose(fp);
+
+    // 신호별 계수 정렬
+    rule_terms = malloc((nterms ? nterms : 1) * sizeof(rule_term));
+    rule_active = malloc((rule_count ? rule_count : 1) * sizeof(int));
+    if (ret == 0 && (!rule_terms || !rule_active)) ret = -1;
+    if (ret == 0) {
+        int pos[HIST_COUNT + 1] = { 0 };
+        for (int i = 0; i < nterms; i++) pos[terms[i].sig + 1]++;
+        for (int s = 0; s < HIST_COUNT; s++) pos[s + 1] += pos[s];
+        memcpy(rule_sig_start, pos, sizeof(pos));
+        for (int i = 0; i < nterms; i++) rule_terms[pos[terms[i].sig]++] = terms[i];
+    }
+    free(terms);
+    return ret;
+}
+
+void rules_cleanup(void) {
+    for (int i = 0; i < rule_count; i++) free(rules[i].msg);
+    free(rules);
+    free(rule_terms);
+    free(rule_active);
+}
+
+/* 메시지 틀의 {신호}를 값으로 바꿔 보낸다 */
+void rule_fire(rule *r, const float *v) {
+    char body[BUF_SIZE];
+    size_t len = 0;
+    for (const char *p = r->msg; *p && len < sizeof(body) - 1; p++) {
+        int s = HIST_COUNT;
+        if (*p == '{') {
+            for (s = 0; s < HIST_COUNT; s++) {
+                size_t n = strlen(hist_metric_names[s]);
+                if (strncmp(p + 1, hist_metric_names[s], n) == 0 && p[n + 1] == '}') break;
+            }
+        }
+        if (s == HIST_COUNT) {
+            body[len++] = *p;
+            continue;
+        }
+        len += snprintf(body + len, sizeof(body) - len, COLOR_YELLOW "%.*f" COLOR_RESET,
+                        s == HIST_LUX ? 0 : s == HIST_PRESSURE ? 2 : 1, v[s]);
+        if (len >= sizeof(body)) len = sizeof(body) - 1;
+        p += strlen(hist_metric_names[s]) + 1;
+    }
+    body[len] = '\0';
+
+    uint64_t t0 = now_ns();
+    msgbuf *b = msgbuf_printf(COLOR_YELLOW "[공지]" COLOR_RESET " %s\n", body), *bin = NULL;
+    if (!b) return;
+    bin = msgbuf_text_frame(WIRE_NOTICE, r->name, body);
+    shard_broadcast(b, bin, MSG_SENSOR, 0, r->user);
+    msgbuf_unref(b);
+    msgbuf_unref(bin);
+    metric_record(MH_BROADCAST, now_ns() - t0);
+}
+
+/* 샘플마다 호출. 값이 바뀐 신호의 항만 다시 평가하고, 조건이 참인 규칙만 발송을 검사한다 */
+void rules_eval(const sensor_sample *smp) {
+    float v[HIST_COUNT] = { smp->temp, smp->pressure / 100.0f, smp->lux };
+    int valid[HIST_COUNT] = {
+        smp->temp_state == SENSOR_OK, smp->temp_state == SENSOR_OK, smp->lux_state == SENSOR_OK
+    };
+    time_t now = smp->ts.tv_sec;
+
+    for (int s = 0; s < HIST_COUNT; s++) {
+        if (valid[s] == rule_prev_valid[s] && (!valid[s] || v[s] == rule_prev[s])) continue;
+        rule_prev_valid[s] = valid[s];
+        rule_prev[s] = v[s];
+        for (int i = rule_sig_start[s]; i < rule_sig_start[s + 1]; i++) {
+            rule_term *t = &rule_terms[i];
+            float thr = t->on ? t->leave : t->enter;
+            int on = valid[s] && (t->op == RULE_GE ? v[s] >= thr : t->op == RULE_GT ? v[s] > thr :
+                                  t->op == RULE_LE ? v[s] <= thr : v[s] < thr);
+            if (on == t->on) continue;
+            t->on = on;
+            rule *r = &rules[t->rule];
+            if (on && ++r->nterms_on == r->nterms) {
+                r->true_since = now;
+                r->fired = 0;
+                r->active_pos = rule_active_count;
+                rule_active[rule_active_count++] = t->rule;
+                rule_next_due = 0;
+            } else if (!on && r->nterms_on-- == r->nterms) {
+                int last = rule_active[--rule_active_count];
+                rule_active[r->active_pos] = last;
+                rules[last].active_pos = r->active_pos;
+                r->active_pos = -1;
+            }
+        }
+    }
+
+    if (now < rule_next_due) return;
+    rule_next_due = (time_t)1 << 62;
+    for (int i = 0; i < rule_active_count; i++) {
+        rule *r = &rules[rule_active[i]];
+        if (r->once && r->fired) continue;
+        time_t due = r->true_since + r->for_sec;
+        if (r->last_fired + r->cooldown > due) due = r->last_fired + r->cooldown;
+        if (now >= due) {
+            rule_fire(r, v);
+            r->last_fired = now;
+            r->fired = 1;
+            if (r->once) continue;
+            due = now + (r->cooldown > 0 ? r->cooldown : 1);
+        }
+        if (due < rule_next_due) rule_next_due = due;
+    }
+}
+
+long long monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* 소유 워커에서 호출 */
+void sub_remove(client_info *c, int m) {
+    sub_bucket *bk = c->sub[m];
+    if (!bk) return;
+    atomic_fetch_sub(&cur_shard->nsubs, 1);
+    client_info *last = bk->subs[m][--bk->n[m]];
+    bk->subs[m][c->sub_pos[m]] = last;
+    last->sub_pos[m] = c->sub_pos[m];
+    c->sub[m] = NULL;
+}
+
+/* 소유 워커에서 호출. 같은 주기의 묶음에 넣고, 없으면 빈 묶음을 재사용하거나 새로 만든다 */
+int sub_add(client_info *c, int m, int interval_ms) {
+    shard *s = cur_shard;
+    sub_bucket *bk = NULL, *empty = NULL;
+    for (int i = 0; i < s->sub_bucket_count; i++) {
+        sub_bucket *b = &s->sub_buckets[i];
+        if (b->interval_ms == interval_ms) {
+            bk = b;
+            break;
+        }
+        if (!empty && b->n[HIST_TEMP] + b->n[HIST_PRESSURE] + b->n[HIST_LUX] == 0) empty = b;
+    }
+    if (!bk) {
+        if (s->sub_bucket_count < SUB_MAX_BUCKETS) bk = &s->sub_buckets[s->sub_bucket_count++];
+        else if (empty) bk = empty;
+        else return -1;
+        bk->interval_ms = interval_ms;
+        bk->due_ms = (monotonic_ms() / interval_ms + 1) * interval_ms;
+    }
+    if (c->sub[m] == bk) return 0;
+    if (bk->n[m] == bk->cap[m]) {
+        int ncap = bk->cap[m] ? bk->cap[m] * 2 : 16;
+        client_info **ns = realloc(bk->subs[m], ncap * sizeof(client_info *));
+        if (!ns) return -1;
+        bk->subs[m] = ns;
+        bk->cap[m] = ncap;
+    }
+    sub_remove(c, m);
+    c->sub[m] = bk;
+    c->sub_pos[m] = bk->n[m];
+    bk->subs[m][bk->n[m]++] = c;
+    atomic_fetch_add(&s->nsubs, 1);
+    return 0;
+}
+
+/* 워커가 새 샘플 알림을 받으면 호출. 때가 된 묶음마다 신호별로 한 번 렌더링해 구독자 전체에 넣는다 */
+void sub_publish(const sensor_sample *smp) {
+    shard *s = cur_shard;
+    long long now = monotonic_ms();
+    for (int i = 0; i < s->sub_bucket_count; i++) {
+        sub_bucket *bk = &s->sub_buckets[i];
+        if (now < bk->due_ms) continue;
+        bk->due_ms = (now / bk->interval_ms + 1) * bk->interval_ms; // 밀린 주기는 건너뜀
+        for (int m = 0; m < HIST_COUNT; m++) {
+            if (bk->n[m] == 0) continue;
+            uint64_t t0 = now_ns();
+            msgbuf *b;
+            enum sensor_state st = m == HIST_LUX ? smp->lux_state : smp->temp_state;
+            if (st != SENSOR_OK)
+                b = msgbuf_printf(COLOR_CYAN "[구독]" COLOR_RESET " %s 센서 읽기 실패\n", m == HIST_LUX ? "조도" : "온도");
+            else if (m == HIST_TEMP)
+                b = msgbuf_printf(COLOR_CYAN "[구독]" COLOR_RESET " 온도: " COLOR_YELLOW "%.1f" COLOR_RESET "°C\n", smp->temp);
+            else if (m == HIST_PRESSURE)
+                b = msgbuf_printf(COLOR_CYAN "[구독]" COLOR_RESET " 기압: " COLOR_YELLOW "%.2f" COLOR_RESET " hPa\n", smp->pressure / 100.0);
+            else
+                b = msgbuf_printf(COLOR_CYAN "[구독]" COLOR_RESET " 조도: " COLOR_YELLOW "%d" COLOR_RESET " lux\n", smp->lux);
+            if (!b) continue;
+            msgbuf *bin = NULL;
+            for (int j = 0; j < bk->n[m]; j++) {
+                client_info *c = bk->subs[m][j];
+                if (c->binary) {
+                    if (!bin) bin = msgbuf_sample_frame(smp, m);
+                    if (bin) client_enqueue_stream(c, bin, m);
+                } else {
+                    client_enqueue_stream(c, b, m);
+                }
+            }
+            msgbuf_unref(b);
+            msgbuf_unref(bin);
+            metric_record(MH_BROADCAST, now_ns() - t0);
+        }
+    }
+}
+
+/* 센서 스레드에서 샘플마다 호출. 구독자가 있는 샤드만 깨우고, 밀린 알림은 하나로 합쳐진다 */
+void sub_notify(void) {
+    for (int i = 0; i < shard_count; i++) {
+        shard *s = &shards[i];
+        if (atomic_load(&s->nsubs) > 0 && atomic_exchange(&s->sample_pending, 1) == 0) shard_wake(s);
+    }
+}
+
+/* 장치 하나를 읽는다. 실패하면 fd를 닫아 다음 주기에 다시 연다 */
+enum sensor_state sensor_read_dev(const char *path, int *fd, char *buf, size_t len) {
+    if (*fd < 0) *fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (*fd < 0) return SENSOR_OPEN_FAIL;
+    lseek(*fd, 0, SEEK_SET);
+    int n = read(*fd, buf, len - 1);
+    if (n <= 0) {
+        close(*fd);
+        *fd = -1;
+        return SENSOR_READ_FAIL;
+    }
+    buf[n] = '\0';
+    return SENSOR_OK;
+}
+
+/* BMP180은 바이너리 ioctl로 읽고, 지원하지 않는 장치(이전 드라이버 등)면 텍스트로 읽는다 */
+enum sensor_state sensor_read_bmp(int *fd, sensor_sample *smp) {
+    char buf[BUF_SIZE];
+    struct bmp180_sample bs;
+    if (*fd < 0) {
+        *fd = open(bmp_dev, O_RDONLY | O_CLOEXEC);
+        if (*fd < 0) return SENSOR_OPEN_FAIL;
+        if (bmp_oss >= 0) {
+            __u32 v = bmp_oss;
+            if (ioctl(*fd, BMP180_IOC_SET_OSS, &v) == -1 && errno != ENOTTY)
+                perror("BMP180 oversampling 설정 실패");
+        }
+    }
+    if (ioctl(*fd, BMP180_IOC_GET_SAMPLE, &bs) == 0) {
+        smp->temp = bs.temperature / 10.0f;
+        smp->pressure = bs.pressure;
+        return SENSOR_OK;
+    }
+    if (errno != ENOTTY) {
+        close(*fd);
+        *fd = -1;
+        return SENSOR_READ_FAIL;
+    }
+    enum sensor_state st = sensor_read_dev(bmp_dev, fd, buf, sizeof(buf));
+    if (st == SENSOR_OK) {
+        smp->temp = parse_temperature(buf);
+        smp->pressure = parse_pressure(buf);
+    }
+    return st;
+}
+
+/* until까지 자되, 종료 요청이 오면 SENSOR_SLEEP_SLICE_MS 안에 돌아온다 */
+void sensor_sleep_until(const struct timespec *until) {
+    struct timespec now, slice;
+    while (server_running) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (now.tv_sec > until->tv_sec || (now.tv_sec == until->tv_sec && now.tv_nsec >= until->tv_nsec)) return;
+        slice.tv_nsec = now.tv_nsec + SENSOR_SLEEP_SLICE_MS * 1000000L;
+        slice.tv_sec = now.tv_sec + slice.tv_nsec / 1000000000L;
+        slice.tv_nsec %= 1000000000L;
+        if (slice.tv_sec > until->tv_sec || (slice.tv_sec == until->tv_sec && slice.tv_nsec > until->tv_nsec))
+            slice = *until;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &slice, NULL);
+    }
+}
+
+/* 읽기에 걸린 시간과 무관하게 일정한 주기를 유지 */
+void sensor_wait_interval(sensor_backend *b, struct timespec *next) {
+    (void)b;
+    next->tv_nsec += (long)sample_interval_ms * 1000000L;
+    next->tv_sec += next->tv_nsec / 1000000000L;
+    next->tv_nsec %= 1000000000L;
+    sensor_sleep_until(next);
+}
+
+void sensor_wait_none(sensor_backend *b, struct timespec *next) {
+    (void)b; (void)next;
+}
+
+int chardev_read(sensor_backend *b, sensor_sample *smp) {
+    char light_buf[BUF_SIZE];
+    uint64_t t0 = now_ns();
+    smp->temp_state = sensor_read_bmp(&b->fd_bmp, smp);
+    uint64_t t1 = now_ns();
+    metric_record(MH_READ_BMP, t1 - t0);
+    if (smp->temp_state != SENSOR_OK) {
+        smp->temp = -999;
+        smp->pressure = -1;
+    }
+    smp->lux_state = sensor_read_dev(bh_dev, &b->fd_bh, light_buf, sizeof(light_buf));
+    metric_record(MH_READ_BH, now_ns() - t1);
+    if (smp->temp_state != SENSOR_OK) metric_add(MC_READ_FAIL_BMP, 1);
+    if (smp->lux_state != SENSOR_OK) metric_add(MC_READ_FAIL_BH, 1);
+    smp->lux = smp->lux_state == SENSOR_OK ? parse_lux(light_buf) : -1;
+    clock_gettime(CLOCK_REALTIME, &smp->ts);
+    return 0;
+}
+
+void chardev_close(sensor_backend *b) {
+    if (b->fd_bmp >= 0) close(b->fd_bmp);
+    if (b->fd_bh >= 0) close(b->fd_bh);
+}
+
+/* libm 없이 쓰는 사인 근사 (포물선 두 개), t는 주기 단위 */
+double synth_wave(double t) {
+    double p = t - (long)t;
+    return p < 0.5 ? 16 * p * (0.5 - p) : -16 * (p - 0.5) * (1 - p);
+}
+
+/* 샘플 번호로 신호 시각을 정하므로 같은 SEED면 값이 항상 같다 */
+int synthetic_read(sensor_backend *b, sensor_sample *smp) {
+    double t = b->n++ * (sample_interval_ms / 1000.0);
+    double day = synth_wave(t / 600.0); // 10분 = 하루
+    double noise = (rand_r(&b->seed) % 1000) / 1000.0 - 0.5;
+    smp->temp_state = rand_r(&b->seed) % 1000 == 0 ? SENSOR_READ_FAIL : SENSOR_OK;
+    smp->lux_state = rand_r(&b->seed) % 1000 == 0 ? SENSOR_READ_FAIL : SENSOR_OK;
+    smp->temp = smp->temp_state == SENSOR_OK ? (float)(24 + 5 * day + noise * 0.2) : -999;
+    smp->pressure = smp->temp_state == SENSOR_OK ? (int)(101325 + 150 * synth_wave(t / 3600.0) + noise * 20) : -1;
+    smp->lux = smp->lux_state == SENSOR_OK ? (int)(day > 0 ? day * 1500 : 0) + (int)(noise * 40 + 20) : -1;
+    clock_gettime(CLOCK_REALTIME, &smp->ts);
+    return 0;
+}
+
+/* 기록 한 줄: ts_ms,temp_state,temp(0.1°C),pressure(Pa),lux_state,lux */
+int replay_read(sensor_backend *b, sensor_sample *smp) {
+    char line[256];
+    while (fgets(line, sizeof(line), b->trace)) {
+        long long ts;
+        int ts_state, ls, temp, pressure, lux;
+        if (line[0] == '#') continue;
+        if (sscanf(line, "%lld,%d,%d,%d,%d,%d", &ts, &ts_state, &temp, &pressure, &ls, &lux) != 6) continue;
+        smp->temp_state = ts_state;
+        smp->lux_state = ls;
+        smp->temp = temp / 10.0f;
+        smp->pressure = pressure;
+        smp->lux = lux;
+        smp->ts.tv_sec = ts / 1000;
+        smp->ts.tv_nsec = ts % 1000 * 1000000;
+        if (b->prev_ms == 0) b->prev_ms = ts;
+        return 0;
+    }
+    return -1;
+}
+
+/* 기록된 간격을 배속으로 나눠 기다린다 */
+void replay_wait(sensor_backend *b, struct timespec *next) {
+    int c = fgetc(b->trace); // 다음 줄의 시각을 보려고 한 글자 미리 읽기
+    long long ts;
+    if (c == EOF) return;
+    ungetc(c, b->trace);
+    long pos = ftell(b->trace);
+    if (b->speed <= 0 || pos < 0 || fscanf(b->trace, "%lld", &ts) != 1) {
+        if (pos >= 0) fseek(b->trace, pos, SEEK_SET);
+        return;
+    }
+    fseek(b->trace, pos, SEEK_SET);
+    long long delta_ns = ts > b->prev_ms ? (long long)((ts - b->prev_ms) * 1e6 / b->speed) : 0;
+    b->prev_ms = ts;
+    next->tv_nsec += delta_ns % 1000000000LL;
+    next->tv_sec += delta_ns / 1000000000LL + next->tv_nsec / 1000000000L;
+    next->tv_nsec %= 1000000000L;
+    sensor_sleep_until(next); // 기록 간격이 몇 시간이어도 종료를 막지 않도록
+}
+
+void replay_close(sensor_backend *b) {
+    fclose(b->trace);
+}
+
+int sensor_backend_open(sensor_backend *b, const char *spec) {
+    memset(b, 0, sizeof(*b));
+    b->fd_bmp = b->fd_bh = -1;
+    b->wait = sensor_wait_interval;
+    if (strcmp(spec, "chardev") == 0) {
+        b->name = "chardev";
+        b->read = chardev_read;
+        b->close = chardev_close;
+        return 0;
+    }
+    if (strncmp(spec, "synthetic", 9) == 0 && (spec[9] == '\0' || spec[9] == ':')) {
+        b->name = "synthetic";
+        b->read = synthetic_read;
+        b->seed = 1;
+        for (const char *p = spec + 9; *p == ':'; p = strchr(p + 1, ':') ? strchr(p + 1, ':') : "") {
+            if (strncmp(p + 1, "max", 3) == 0) b->wait = sensor_wait_none;
+            else b->seed = strtoul(p + 1, NULL, 10);
+        }
+        return 0;
+    }
+    if (strncmp(spec, "replay:", 7) == 0) {
+        char path[PATH_MAX];
+        const char *colon = strrchr(spec + 7, ':');
+        b->speed = 1;
+        if (colon) {
+            b->speed = strcmp(colon + 1, "max") == 0 ? 0 : atof(colon + 1);
+            if (b->speed < 0 || (b->speed == 0 && strcmp(colon + 1, "max") != 0)) return -1;
+        }
+        snprintf(path, sizeof(path), "%.*s", (int)(colon ? colon - spec - 7 : (long)strlen(spec + 7)), spec + 7);
+        b->trace = fopen(path, "r");
+        if (!b->trace) return -1;
+        b->name = "replay";
+        b->read = replay_read;
+        b->wait = replay_wait;
+        b->close = replay_close;
+        return 0;
+    }
+    errno = EINVAL;
+    return -1;
+}
+
+/* 센서를 소유하는 유일한 스레드. 백엔드에서 샘플을 받아 스냅샷을 발행하고 공지를 판단한다 */
+void *sensor_monitor(void *arg) {
+    sensor_backend *src = arg;
+    sensor_sample smp = { 0 };
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    while (server_running) {
+        if (src->read(src, &smp) < 0) {
+            printf(COLOR_CYAN "[서버] 센서 기록 재생 완료 (%lu개)\n" COLOR_RESET, smp.seq);
+            break;
+        }
+        smp.seq++;
+        if (sensor_record)
+            fprintf(sensor_record, "%lld,%d,%d,%d,%d,%d\n",
+                    (long long)smp.ts.tv_sec * 1000 + smp.ts.tv_nsec / 1000000,
+                    smp.temp_state, (int)(smp.temp * 10 + (smp.temp < 0 ? -0.5f : 0.5f)), smp.pressure,
+                    smp.lux_state, smp.lux);
+        sensor_publish(&smp);
+        history_record(&smp);
+        store_append(&smp);
+
+        rules_eval(&smp);
+        sub_notify();
+
+        src->wait(src, &next);
+    }
+    if (src->close) src->close(src);
+    return NULL;
+}
+
+/* /range 응답을 만든다 (풀 스레드) */
+void range_reply(const char *args, char *msg, size_t cap) {
+    static const char *units[HIST_COUNT] = { "°C", " hPa", " lux" };
+    static const char *labels[HIST_COUNT] = { "온도", "기압", "조도" };
+    static const double scale[HIST_COUNT] = { 10, 100, 1 }; // 저장 단위 -> 표시 단위
+    char name[16] = "", unit = 0;
+    long count = 0;
+    double thr_in = 0;
+    int m, n = sscanf(args, "%15s %ld%c >%lf", name, &count, &unit, &thr_in);
+    for (m = 0; m < HIST_COUNT && strcmp(name, hist_metric_names[m]) != 0; m++);
+    long sec = unit == 'm' ? 60 : unit == 'h' ? 3600 : unit == 'd' ? 86400 : 0;
+    if (n < 3 || m == HIST_COUNT || sec == 0 || count <= 0) {
+        snprintf(msg, cap, COLOR_CYAN "[서버]" COLOR_RESET " 사용법: /range <temp|pressure|lux> <N>[m|h|d] [>값]\n");
+        return;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    uint64_t to_ms = (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+    uint64_t span = (uint64_t)count * sec * 1000;
+    int32_t thr = n == 4 ? (int32_t)(thr_in * scale[m] + (thr_in < 0 ? -0.5 : 0.5)) : INT32_MAX;
+    store_agg agg;
+    if (store_query(m, span < to_ms ? to_ms - span : 0, to_ms, thr, &agg) < 0) {
+        snprintf(msg, cap, COLOR_CYAN "[서버]" COLOR_RESET " 저장소가 꺼져 있습니다. (--store-dir)\n");
+        return;
+    }
+    if (agg.count == 0) {
+        snprintf(msg, cap, COLOR_CYAN "[서버]" COLOR_RESET " 최근 %ld%c 동안 저장된 %s 기록이 없습니다.\n", count, unit, labels[m]);
+        return;
+    }
+    int len = snprintf(msg, cap,
+        "[서버] 저장된 최근 %ld%c %s: 평균 " COLOR_YELLOW "%.1f" COLOR_RESET "%s, 최저 %.1f%s, 최고 %.1f%s (샘플 %u개)",
+        count, unit, labels[m], agg.sum / scale[m] / agg.count, units[m],
+        agg.min / scale[m], units[m], agg.max / scale[m], units[m], agg.count);
+    if (n == 4)
+        snprintf(msg + len, cap - len, ", %.1f%s 초과 %u개 (%.1f%%)\n",
+                 thr_in, units[m], agg.above, 100.0 * agg.above / agg.count);
+    else
+        snprintf(msg + len, cap - len, "\n");
+}
+
+/* ---- 작업 풀 ---- */
+
+const char *pool_busy_msg = COLOR_CYAN "[서버]" COLOR_RESET " 요청이 많습니다. 잠시 후 다시 시도해 주세요.\n";
+
+/* 연결을 소유한 워커에서 호출. 종류별 상한이나 큐가 차 있으면 -1 (바로 거절) */
+int pool_submit(enum task_type type, client_info *c, const char *arg) {
+    task *t = NULL;
+    if (atomic_fetch_add(&task_inflight[type], 1) < task_limit[type] && (t = malloc(sizeof(task))) != NULL) {
+        t->type = type;
+        t->owner = c->id;
+        t->binary = c->binary;
+        t->queued_ns = now_ns();
+        snprintf(t->arg, sizeof(t->arg), "%s", arg);
+        unsigned start = atomic_fetch_add(&pool_next, 1);
+        for (int i = 0; i < pool_size; i++) {
+            pool_worker *w = &pool[(start + i) % pool_size];
+            pthread_mutex_lock(&w->lock);
+            if (w->count < POOL_QUEUE_CAP) {
+                w->q[(w->head + w->count++) % POOL_QUEUE_CAP] = t;
+                pthread_mutex_unlock(&w->lock);
+                c->pool_pending = 1;
+                pthread_mutex_lock(&pool_idle_lock);
+                pool_queued++;
+                pthread_cond_signal(&pool_idle);
+                pthread_mutex_unlock(&pool_idle_lock);
+                return 0;
+            }
+            pthread_mutex_unlock(&w->lock);
+        }
+        free(t);
+    }
+    atomic_fetch_sub(&task_inflight[type], 1);
+    atomic_fetch_add(&task_rejected[type], 1);
+    return -1;
+}
+
+task *pool_take(pool_worker *w) {
+    task *t = NULL;
+    pthread_mutex_lock(&w->lock);
+    if (w->count > 0) {
+        t = w->q[w->head];
+        w->head = (w->head + 1) % POOL_QUEUE_CAP;
+        w->count--;
+    }
+    pthread_mutex_unlock(&w->lock);
+    if (t) {
+        pthread_mutex_lock(&pool_idle_lock);
+        pool_queued--;
+        pthread_mutex_unlock(&pool_idle_lock);
+    }
+    return t;
+}
+
+/* 결과를 요청한 연결의 샤드로 보낸다. 그 사이 연결이 끊겼으면 샤드가 버린다 */
+void task_complete(task *t, const char *reply) {
+    shard *s = &shards[HANDLE_SHARD(t->owner)];
+    shard_msg *m = calloc(1, sizeof(shard_msg));
+    if (!m) return;
+    // 응답을 못 만들어도 보내서 멈춰 둔 연결을 풀어 준다
+    m->text = t->binary ? msgbuf_text_frame(WIRE_TEXT, NULL, reply) : msgbuf_printf("%s", reply);
+    m->kind = MSG_TEXT;
+    m->target = t->owner;
+    m->posted_ns = now_ns();
+    mpsc_push(&s->inbox, m);
+    shard_wake(s);
+}
+
+void task_run(task *t) {
+    char reply[2048];
+    uint64_t t0 = now_ns();
+    metric_record(MH_POOL_WAIT, t0 - t->queued_ns);
+    atomic_fetch_add(&task_running[t->type], 1);
+    switch (t->type) {
+    case TASK_RANGE:
+        range_reply(t->arg, reply, sizeof(reply));
+        break;
+    case TASK_STATS:
+        metrics_render_text(reply, sizeof(reply));
+        break;
+    default:
+        reply[0] = '\0';
+    }
+    atomic_fetch_sub(&task_running[t->type], 1);
+    metric_record(MH_POOL_RUN, now_ns() - t0);
+    task_complete(t, reply);
+    atomic_fetch_sub(&task_inflight[t->type], 1);
+    free(t);
+}
+
+/* 자기 큐부터, 비었으면 이웃 큐를 차례로 훔친다. 모두 비면 잠든다 */
+void *pool_main(void *arg) {
+    pool_worker *self = arg;
+    int me = self - pool;
+    for (;;) {
+        task *t = NULL;
+        for (int i = 0; i < pool_size && !t; i++) t = pool_take(&pool[(me + i) % pool_size]);
+        if (t) {
+            task_run(t);
+            continue;
+        }
+        pthread_mutex_lock(&pool_idle_lock);
+        while (pool_queued == 0 && !pool_stop) pthread_cond_wait(&pool_idle, &pool_idle_lock);
+        int stop = pool_stop;
+        pthread_mutex_unlock(&pool_idle_lock);
+        if (stop) return NULL;
+    }
+}
+
+int pool_start(void) {
+    if (!(pool = calloc(pool_size, sizeof(pool_worker)))) return -1;
+    for (int i = 0; i < pool_size; i++) {
+        pthread_mutex_init(&pool[i].lock, NULL);
+        if (pthread_create(&pool[i].thread, NULL, pool_main, &pool[i]) != 0) return -1;
+    }
+    return 0;
+}
+
+/* 샤드 워커가 모두 끝난 뒤 호출. 풀 스레드는 큐를 비우고 끝나며, 완료 메시지는 shard_cleanup이 버린다 */
+void pool_shutdown(void) {
+    pthread_mutex_lock(&pool_idle_lock);
+    pool_stop = 1;
+    pthread_cond_broadcast(&pool_idle);
+    pthread_mutex_unlock(&pool_idle_lock);
+    for (int i = 0; i < pool_size; i++) {
+        pthread_join(pool[i].thread, NULL);
+        pthread_mutex_destroy(&pool[i].lock);
+    }
+    free(pool);
+}
+
+/*
+ * 닉네임을 정한 직후 호출. 최근 방송, 최신 센서 값, 캐시된 예보를 버퍼 참조로만 송신 큐에
+ * 넣으므로 입장마다 할당하지 않고, 읽기 묶음이 끝날 때 환영 인사와 함께 writev 한 번으로 나간다.
+ */
+void backlog_send(client_info *c) {
+    sensor_sample smp;
+    forecast_snapshot *snap = forecast_get();
+    sensor_snapshot(&smp);
+    pthread_mutex_lock(&backlog_lock);
+    for (unsigned long i = backlog_n > (unsigned long)backlog_size ? backlog_n - backlog_size : 0; i < backlog_n; i++) {
+        backlog_entry *e = &backlog_ring[i % backlog_size];
+        msgbuf *b = c->binary ? e->bin : e->text;
+        if (b) client_enqueue(c, b, e->kind);
+    }
+    if (smp.seq != 0 && smp.seq != backlog_sensor_seq) {
+        // 입장 물결이 몰려도 샘플 하나당 한 번만 렌더링한다
+        char temp[96], lux[96];
+        if (smp.temp_state == SENSOR_OK)
+            snprintf(temp, sizeof(temp), "온도 " COLOR_YELLOW "%.1f" COLOR_RESET "°C, 기압 %.2f hPa", smp.temp, smp.pressure / 100.0);
+        else
+            snprintf(temp, sizeof(temp), "온도 센서 %s", smp.temp_state == SENSOR_READ_FAIL ? "읽기 실패" : "장치 열기 실패");
+        if (smp.lux_state == SENSOR_OK)
+            snprintf(lux, sizeof(lux), "조도 " COLOR_YELLOW "%d" COLOR_RESET " lux", smp.lux);
+        else
+            snprintf(lux, sizeof(lux), "조도 센서 %s", smp.lux_state == SENSOR_READ_FAIL ? "읽기 실패" : "장치 열기 실패");
+        msgbuf *text = msgbuf_printf("[서버] 현재 %s, %s\n", temp, lux);
+        msgbuf *bin = msgbuf_sample_frame(&smp, HIST_TEMP);
+        if (text && bin) {
+            msgbuf_unref(backlog_sensor_text);
+            msgbuf_unref(backlog_sensor_bin);
+            backlog_sensor_text = text;
+            backlog_sensor_bin = bin;
+            backlog_sensor_seq = smp.seq;
+        } else {
+            msgbuf_unref(text);
+            msgbuf_unref(bin);
+        }
+    }
+    msgbuf *sb = c->binary ? backlog_sensor_bin : backlog_sensor_text;
+    if (sb) client_enqueue(c, sb, MSG_SENSOR);
+    pthread_mutex_unlock(&backlog_lock);
+    if (snap && snap->ok) client_enqueue(c, c->binary ? snap->bin : snap->msg, MSG_TEXT);
+    forecast_put(snap);
+}
+
+void backlog_cleanup(void) {
+    for (int i = 0; i < BACKLOG_MAX; i++) {
+        msgbuf_unref(backlog_ring[i].text);
+        msgbuf_unref(backlog_ring[i].bin);
+    }
+    msgbuf_unref(backlog_sensor_text);
+    msgbuf_unref(backlog_sensor_bin);
+}
+
+void close_client(client_info *cinfo) {
+    if (cinfo->state == CLIENT_CHAT)
+        printf(COLOR_RED "[서버] %s 클라이언트 연결 종료\n"COLOR_RESET, cinfo->nickname);
+    for (int m = 0; m < HIST_COUNT; m++) sub_remove(cinfo, m);
+    registry_remove(cur_shard, cinfo);
+    atomic_fetch_sub(&client_total, 1);
+    outq_clear(cinfo);
+    close(cinfo->sockfd);
+    free(cinfo);
+}
+
+void handle_nickname(client_info *cinfo, char *buf) {
+    size_t hello = strlen(WIRE_HELLO_LINE);
+    if (!cinfo->binary && strncmp(buf, WIRE_HELLO_LINE, hello) == 0) {
+        unsigned char ver = WIRE_VERSION;
+        msgbuf *b = msgbuf_frame(WIRE_HELLO, &ver, 1);
+        cinfo->binary = 1;
+        if (b) {
+            client_enqueue(cinfo, b, MSG_TEXT);
+            msgbuf_unref(b);
+        }
+        return;
+    }
+    if (!cinfo->deflate && strncmp(buf, WIRE_DEFLATE_LINE, strlen(WIRE_DEFLATE_LINE)) == 0) {
+        unsigned char hello[2] = { WIRE_VERSION, WIRE_HELLO_DEFLATE };
+        msgbuf *b = msgbuf_frame(WIRE_HELLO, hello, sizeof(hello));
+        if (b) {
+            client_enqueue(cinfo, b, MSG_TEXT); // 응답 자체는 압축하지 않는다
+            msgbuf_unref(b);
+        }
+        cinfo->deflate = 1;
+        return;
+    }
+    size_t nicklen = strlen(buf);
+    if (nicklen > 0 && buf[nicklen-1] == '\n')
+        buf[nicklen-1] = '\0';
+    if (strlen(buf) == 0) {
+        client_send(cinfo, ask_nick);
+        return;
+    }
+    snprintf(cinfo->nickname, NICK_SIZE, "%s", buf);
+    cinfo->state = CLIENT_CHAT;
+
+    char welcome[BUF_SIZE*2];
+    snprintf(welcome, sizeof(welcome),
+        COLOR_CYAN "[알림] 당신의 ID는 " COLOR_GREEN "%s" COLOR_CYAN " 입니다. ☀️'" COLOR_YELLOW "웨더" COLOR_CYAN "'에 오신걸 환영합니다.\n" COLOR_RESET,
+        cinfo->nickname);
+    client_send(cinfo, welcome);
+    backlog_send(cinfo);
+}
+
+void handle_message(client_info *cinfo, char *buf) {
+    char msg_with_nick[BUF_SIZE * 2];
+    size_t len = strlen(buf);
+    if (len > 0 && buf[len - 1] == '\n') buf[len - 1] = '\0';
+
+    if (buf[0] == '/') {
+        if (strcmp(buf, "/weather") == 0) {
+            // 캐시된 스냅샷을 그대로 보내고, 오래됐으면 갱신만 요청한다 (블로킹 없음)
+            forecast_snapshot *snap = forecast_get();
+            if (snap) {
+                client_enqueue(cinfo, cinfo->binary ? snap->bin : snap->msg, MSG_TEXT);
+            } else {
+                client_send(cinfo, COLOR_YELLOW "[서버] 기상청 예보를 아직 받아오지 못했습니다.\n" COLOR_RESET);
+            }
+            if (forecast_stale(snap)) forecast_kick();
+            forecast_put(snap);
+            return;
+        } else if (cinfo->binary && (strcmp(buf, "/temp") == 0 || strcmp(buf, "/lux") == 0)) {
+            // 바이너리 클라이언트에게는 문장 대신 샘플 그대로
+            sensor_sample smp;
+            sensor_snapshot(&smp);
+            msgbuf *b = msgbuf_sample_frame(&smp, buf[1] == 't' ? HIST_TEMP : HIST_LUX);
+            if (b) {
+                client_enqueue(cinfo, b, MSG_TEXT);
+                msgbuf_unref(b);
+            }
+            return;
+        } else if (strcmp(buf, "/temp") == 0) {
+            sensor_sample smp;
+            sensor_snapshot(&smp);
+            if (smp.temp_state == SENSOR_OK) {
+                char msg[128];
+                snprintf(msg, sizeof(msg), "[서버] 현재 온도: " COLOR_YELLOW "%.1f" COLOR_RESET "°C\n", smp.temp);
+                client_send(cinfo, msg);
+            } else if (smp.temp_state == SENSOR_READ_FAIL) {
+                const char *msg = COLOR_CYAN "[서버]" COLOR_RESET " 온도 센서 읽기 실패\n";
+                client_send(cinfo, msg);
+            } else {
+                const char *msg = COLOR_CYAN "[서버]" COLOR_RESET " 온도 센서 장치 열기 실패\n";
+                client_send(cinfo, msg);
+            }
+            return;
+        } else if (strcmp(buf, "/lux") == 0) {
+            sensor_sample smp;
+            sensor_snapshot(&smp);
+            if (smp.lux_state == SENSOR_OK) {
+                char msg[128];
+                snprintf(msg, sizeof(msg), "[서버] 현재 조도: " COLOR_YELLOW "%d" COLOR_RESET " lux\n", smp.lux);
+                client_send(cinfo, msg);
+            } else if (smp.lux_state == SENSOR_READ_FAIL) {
+                const char *msg = COLOR_CYAN "[서버]" COLOR_RESET " 조도 센서 읽기 실패\n";
+                client_send(cinfo, msg);
+            } else {
+                const char *msg = COLOR_CYAN "[서버]" COLOR_RESET " 조도 센서 장치 열기 실패\n";
+                client_send(cinfo, msg);
+            }
+            return;
+        } else if (strncmp(buf, "/history", 8) == 0 && (buf[8] == ' ' || buf[8] == '\0')) {
+            static const char *windows[HIST_LEVELS] = { "1m", "1h", "24h" };
+            static const char *units[HIST_COUNT] = { "°C", " hPa", " lux" };
+            static const char *labels[HIST_COUNT] = { "온도", "기압", "조도" };
+            char name[16] = "", win[8] = "";
+            int m, l;
+            sscanf(buf + 8, "%15s %7s", name, win);
+            for (m = 0; m < HIST_COUNT && strcmp(name, hist_metric_names[m]) != 0; m++);
+            for (l = 0; l < HIST_LEVELS && strcmp(win, windows[l]) != 0; l++);
+            if (m == HIST_COUNT || l == HIST_LEVELS) {
+                client_send(cinfo, COLOR_CYAN "[서버]" COLOR_RESET " 사용법: /history <temp|pressure|lux> <1m|1h|24h>\n");
+                return;
+            }
+            hist_bucket agg;
+            char msg[256];
+            if (history_query(m, l, &agg) < 0) {
+                snprintf(msg, sizeof(msg), COLOR_CYAN "[서버]" COLOR_RESET " 최근 %s 동안 %s 기록이 없습니다.\n", windows[l], labels[m]);
+            } else {
+                snprintf(msg, sizeof(msg),
+                    "[서버] 최근 %s %s: 평균 " COLOR_YELLOW "%.1f" COLOR_RESET "%s, 최저 %.1f%s, 최고 %.1f%s (샘플 %u개)\n",
+                    windows[l], labels[m], agg.sum / agg.count, units[m],
+                    agg.min, units[m], agg.max, units[m], agg.count);
+            }
+            client_send(cinfo, msg);
+            return;
+        } else if (strncmp(buf, "/range", 6) == 0 && (buf[6] == ' ' || buf[6] == '\0')) {
+            // 저장소 스캔은 디스크를 건드릴 수 있으므로 풀에서
+            if (pool_submit(TASK_RANGE, cinfo, buf + 6) < 0) client_send(cinfo, pool_busy_msg);
+            return;
+        } else if (strncmp(buf, "/subscribe", 10) == 0 && (buf[10] == ' ' || buf[10] == '\0')) {
+            static const char *labels[HIST_COUNT] = { "온도", "기압", "조도" };
+            char name[16] = "", unit[4] = "s", msg[192];
+            long interval = 0;
+            int m;
+            sscanf(buf + 10, "%15s %ld%3s", name, &interval, unit);
+            for (m = 0; m < HIST_COUNT && strcmp(name, hist_metric_names[m]) != 0; m++);
+            long scale = strcmp(unit, "ms") == 0 ? 1 : strcmp(unit, "s") == 0 ? 1000 : strcmp(unit, "m") == 0 ? 60000 : 0;
+            if (m == HIST_COUNT || interval <= 0 || scale == 0 || interval > SUB_MAX_INTERVAL_MS / scale) {
+                client_send(cinfo, COLOR_CYAN "[서버]" COLOR_RESET " 사용법: /subscribe <temp|pressure|lux> <주기>[ms|s|m]\n");
+                return;
+            }
+            interval *= scale;
+            if (interval < sample_interval_ms) interval = sample_interval_ms; // 샘플링보다 빠를 수는 없다
+            int ret = sub_add(cinfo, m, interval);
+            if (ret < 0)
+                snprintf(msg, sizeof(msg), COLOR_CYAN "[서버]" COLOR_RESET " 구독 주기가 너무 다양합니다. 다른 주기를 골라 주세요.\n");
+            else
+                snprintf(msg, sizeof(msg), "[서버] %s를 %ldms마다 보내드립니다.\n", labels[m], interval);
+            client_send(cinfo, msg);
+            return;
+        } else if (strncmp(buf, "/unsubscribe", 12) == 0 && (buf[12] == ' ' || buf[12] == '\0')) {
+            char name[16] = "";
+            int m;
+            sscanf(buf + 12, "%15s", name);
+            for (m = 0; m < HIST_COUNT && strcmp(name, hist_metric_names[m]) != 0; m++);
+            if (name[0] && m == HIST_COUNT) {
+                client_send(cinfo, COLOR_CYAN "[서버]" COLOR_RESET " 사용법: /unsubscribe [temp|pressure|lux]\n");
+                return;
+            }
+            for (int i = 0; i < HIST_COUNT; i++)
+                if (!name[0] || i == m) sub_remove(cinfo, i);
+            client_send(cinfo, "[서버] 구독을 해지했습니다.\n");
+            return;
+        } else if (strcmp(buf, "/stats") == 0) {
+            if (!cinfo->admin) {
+                client_send(cinfo, COLOR_CYAN "[서버]" COLOR_RESET " /stats는 서버에서 직접 접속한 경우에만 쓸 수 있습니다.\n");
+                return;
+            }
+            if (pool_submit(TASK_STATS, cinfo, "") < 0) client_send(cinfo, pool_busy_msg);
+            return;
+        } else {
+            const char *msg = COLOR_CYAN "[서버]" COLOR_RESET " 알 수 없는 명령어입니다. 명령어 목록: /temp, /lux, /weather, /history, /range, /subscribe, /unsubscribe\n";
+            client_send(cinfo, msg);
+            return;
+        }
+    }
+
+    snprintf(msg_with_nick, sizeof(msg_with_nick), "%s: %s\n", cinfo->nickname, buf);
+    broadcast_with_color(cinfo, buf);
+    printf("%s", msg_with_nick);
+}
+
+/* 버퍼에 모인 완성된 줄을 하나씩 처리한다. 줄바꿈 없이 버퍼가 차면 그대로 한 줄로 본다 */
+void client_dispatch_lines(client_info *c) {
+    size_t start = 0;
+    while (!c->pool_pending) {
+        char *nl = memchr(c->inbuf + start, '\n', c->inlen - start);
+        size_t end;
+        if (nl) end = nl - c->inbuf + 1;
+        else if (start == 0 && c->inlen == sizeof(c->inbuf) - 1) end = c->inlen;
+        else break;
+        char next = c->inbuf[end];
+        c->inbuf[end] = '\0';
+        if (c->state == CLIENT_NICK)
+            handle_nickname(c, c->inbuf + start);
+        else
+            handle_message(c, c->inbuf + start);
+        c->inbuf[end] = next;
+        start = end;
+    }
+    memmove(c->inbuf, c->inbuf + start, c->inlen - start);
+    c->inlen -= start;
+}
+
+/* edge-triggered이므로 EAGAIN이 나올 때까지 모두 읽는다.
+ * 한 번에 들어온 명령(파이프라이닝)의 응답은 큐에 모아 마지막에 writev 한 번으로 보낸다 */
+void on_client_event(io_handler *h, uint32_t events) {
+    client_info *cinfo = (client_info *)h;
+
+    if (events & EPOLLOUT) {
+        client_flush(cinfo);
+    }
+    cinfo->corked = 1;
+    client_dispatch_lines(cinfo); // 풀 응답을 기다리느라 남겨 둔 줄
+    while (server_running && !cinfo->pool_pending) {
+        ssize_t bytes_recv = recv(cinfo->sockfd, cinfo->inbuf + cinfo->inlen,
+                                  sizeof(cinfo->inbuf) - 1 - cinfo->inlen, 0);
+        if (bytes_recv < 0 && errno == EINTR) continue;
+        if (bytes_recv < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (bytes_recv <= 0) {
+            close_client(cinfo);
+            return;
+        }
+        metric_add(MC_BYTES_IN, bytes_recv);
+        cinfo->inlen += bytes_recv;
+        client_dispatch_lines(cinfo);
+    }
+    cinfo->corked = 0;
+    client_flush(cinfo);
+}
+
+void on_listen_event(io_handler *h, uint32_t events) {
+    struct sockaddr_in client_addr;
+    socklen_t sock_size;
+    (void)h; (void)events;
+
+    while (server_running) {
+        sock_size = sizeof(struct sockaddr_in);
+        int client_sfd = accept4(cur_shard->listen_fd, (struct sockaddr *)&client_addr, &sock_size,
+                                 SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_sfd == -1) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("accept() error");
+            return;
+        }
+        if (atomic_fetch_add(&client_total, 1) >= MAX_CLIENTS) {
+            atomic_fetch_sub(&client_total, 1);
+            printf("[서버] 최대 클라이언트 수 초과, 접속 거부\n");
+            close(client_sfd);
+            continue;
+        }
+        // 묶어 보내기는 outq의 writev가 이미 하므로 Nagle로 지연 ACK를 기다릴 이유가 없다
+        int on = 1;
+        setsockopt(client_sfd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        client_info *cinfo = calloc(1, sizeof(client_info));
+        if (!cinfo) {
+            atomic_fetch_sub(&client_total, 1);
+            perror("calloc() error");
+            close(client_sfd);
+            continue;
+        }
+        cinfo->io.on_event = on_client_event;
+        cinfo->sockfd = client_sfd;
+        cinfo->state = CLIENT_NICK;
+        cinfo->admin = (ntohl(client_addr.sin_addr.s_addr) >> 24) == 127;
+        if (registry_add(cur_shard, cinfo) == -1) {
+            atomic_fetch_sub(&client_total, 1);
+            printf("[서버] 클라이언트 등록 실패, 접속 거부\n");
+            close(client_sfd);
+            free(cinfo);
+            continue;
+        }
+        printf(COLOR_CYAN "[서버] 새로운 클라이언트 접속: (%s)\n" COLOR_RESET, inet_ntoa(client_addr.sin_addr));
+
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, .data.ptr = cinfo };
+        if (epoll_ctl(cur_shard->epoll_fd, EPOLL_CTL_ADD, client_sfd, &ev) == -1) {
+            perror("epoll_ctl() error");
+            close_client(cinfo);
+            continue;
+        }
+        client_send(cinfo, ask_nick);
+    }
+}
+
+void on_stdin_event(io_handler *h, uint32_t events) {
+    char input_buf[BUF_SIZE];
+    (void)h; (void)events;
+
+    memset(input_buf, 0, sizeof(input_buf));
+    while (fgets(input_buf, sizeof(input_buf), stdin) != NULL) {
+        size_t len = strlen(input_buf);
+        if (len > 0 && input_buf[len - 1] == '\n') {
+            input_buf[len - 1] = '\0';
+        }
+        if (strcmp(input_buf, "/stats") == 0) {
+            char stats[2048];
+            metrics_render_text(stats, sizeof(stats));
+            printf("%s", stats);
+        } else if (strlen(input_buf) > 0) {
+            char notice[BUF_SIZE * 2];
+            snprintf(notice, sizeof(notice), COLOR_YELLOW "[공지]" COLOR_RESET "%s\n", input_buf);
+            printf(COLOR_RED "%s" COLOR_RESET, notice);
+            msgbuf *b = msgbuf_printf("%s", notice);
+            msgbuf *bin = msgbuf_text_frame(WIRE_NOTICE, NULL, input_buf);
+            if (b && bin) shard_broadcast(b, bin, MSG_TEXT, 0, NULL);
+            msgbuf_unref(b);
+            msgbuf_unref(bin);
+        }
+        memset(input_buf, 0, sizeof(input_buf));
+    }
+    clearerr(stdin); // EAGAIN으로 끝난 경우 다음 이벤트에서 다시 읽도록
+}
+
+/* Prometheus 수집 요청: 요청 헤더를 다 받으면 응답을 보내고 닫는다 (요청 내용은 보지 않음) */
+typedef struct {
+    io_handler io; // 반드시 첫 멤버
+    int fd;
+    size_t got;
+    char req[1024];
+    // 렌더링한 응답. 느린 수집기는 EPOLLOUT에서 이어 보낸다
+    char hdr[160];
+    size_t hdr_len;
+    char *body;
+    size_t body_len;
+    size_t sent; // hdr + body 중 보낸 바이트
+} metrics_conn;
+
+void metrics_conn_close(metrics_conn *mc) {
+    close(mc->fd); // epoll에서도 빠진다
+    free(mc->body);
+    free(mc);
+}
+
+void on_metrics_conn_event(io_handler *h, uint32_t events) {
+    metrics_conn *mc = (metrics_conn *)h;
+    (void)events;
+    while (!mc->body) {
+        ssize_t n = recv(mc->fd, mc->req + mc->got, sizeof(mc->req) - 1 - mc->got, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (n <= 0) {
+            metrics_conn_close(mc);
+            return;
+        }
+        mc->got += n;
+        mc->req[mc->got] = '\0';
+        if (strstr(mc->req, "\r\n\r\n") || strstr(mc->req, "\n\n") || mc->got == sizeof(mc->req) - 1) {
+            if (!(mc->body = metrics_render_prometheus(&mc->body_len))) {
+                metrics_conn_close(mc);
+                return;
             }
-            cinfo->sockfd = client_sfd;
-            memset(cinfo->nickname, 0, NICK_SIZE);
-            clients[client_count++] = *cinfo;
-            pthread_mutex_unlock(&mutex);
-            printf(COLOR_CYAN "[서버] 새로운 클라이언트 접속: (%s)\n" COLOR_RESET, inet_ntoa(client_addr.sin_addr));
-            pthread_create(&tid, NULL, client_handler, (void *)cinfo);
-            pthread_detach(tid);
-        }
-
-        if (FD_ISSET(STDIN_FILENO, &readfds)) {
-            char input_buf[BUF_SIZE];
-            memset(input_buf, 0, sizeof(input_buf));
-            if (fgets(input_buf, sizeof(input_buf), stdin) != NULL) {
-                size_t len = strlen(input_buf);
-                if (len > 0 && input_buf[len - 1] == '\n') {
-                    input_buf[len - 1] = '\0';
-                }
-                if (strlen(input_buf) > 0) {
-                    char notice[BUF_SIZE * 2];
-                    snprintf(notice, sizeof(notice), COLOR_YELLOW "[공지]" COLOR_RESET "%s\n", input_buf);
-                    printf(COLOR_RED "%s" COLOR_RESET, notice);
-                    pthread_mutex_lock(&mutex);
-                    for (int i = 0; i < client_count; i++) {
-                        send(clients[i].sockfd, notice, strlen(notice), 0);
-                    }
-                    pthread_mutex_unlock(&mutex);
-                }
+            mc->hdr_len = snprintf(mc->hdr, sizeof(mc->hdr), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                                   "Content-Length: %zu\r\nConnection: close\r\n\r\n", mc->body_len);
+        }
+    }
+    // 메인 루프를 막지 않도록 논블로킹으로 보내고, 막히면 EPOLLOUT에서 이어 간다
+    while (mc->sent < mc->hdr_len + mc->body_len) {
+        struct iovec iov[2];
+        int cnt = 0;
+        if (mc->sent < mc->hdr_len)
+            iov[cnt++] = (struct iovec){ mc->hdr + mc->sent, mc->hdr_len - mc->sent };
+        size_t boff = mc->sent > mc->hdr_len ? mc->sent - mc->hdr_len : 0;
+        iov[cnt++] = (struct iovec){ mc->body + boff, mc->body_len - boff };
+        ssize_t n = writev(mc->fd, iov, cnt);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (n < 0) break;
+        mc->sent += n;
+    }
+    metrics_conn_close(mc);
+}
+
+void on_metrics_listen_event(io_handler *h, uint32_t events) {
+    (void)h; (void)events;
+    while (server_running) {
+        int fd = accept4(metrics_sfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("metrics accept() error");
+            return;
+        }
+        metrics_conn *mc = calloc(1, sizeof(metrics_conn));
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, .data.ptr = mc };
+        if (!mc) {
+            close(fd);
+            continue;
+        }
+        mc->io.on_event = on_metrics_conn_event;
+        mc->fd = fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+            metrics_conn_close(mc);
+            continue;
+        }
+        on_metrics_conn_event(&mc->io, EPOLLIN); // 요청이 이미 와 있을 수 있다
+    }
+}
+
+/* 루프백에만 연다. 외부 노출은 앞단 프록시나 수집기의 몫 */
+int metrics_listen(int port) {
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    int yes = 1;
+    metrics_sfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (metrics_sfd == -1) return -1;
+    setsockopt(metrics_sfd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    if (bind(metrics_sfd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(metrics_sfd, 16) == -1) {
+        close(metrics_sfd);
+        metrics_sfd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+/* ---- 읽기 전용 JSON API ---- */
+
+/*
+ * 대시보드용 GET /api/sample, /api/history, /api/forecast.
+ * 데이터가 바뀐 뒤 첫 요청 때 200 응답 전체(헤더 포함)와 304 응답을 한 번씩 만들어 두고,
+ * 이후 요청은 그 버퍼를 그대로 보낸다. If-None-Match가 ETag와 맞으면 304만 나간다.
+ * 메인 스레드 epoll에서만 돌아가므로 문서와 연결에 잠금이 없다.
+ */
+typedef struct {
+    const char *path;
+    char kind;             // ETag 접두사
+    unsigned long version; // 데이터 버전. 바뀌면 다시 만든다
+    int built;
+    char etag[48];
+    msgbuf *ok, *not_modified;
+} api_doc;
+
+enum { API_SAMPLE, API_HISTORY, API_FORECAST, API_DOCS };
+
+api_doc api_docs[API_DOCS] = {
+    { .path = "/api/sample", .kind = 's' },
+    { .path = "/api/history", .kind = 'h' },
+    { .path = "/api/forecast", .kind = 'f' },
+};
+msgbuf *api_not_found, *api_bad_request, *api_unavailable;
+uint64_t api_nonce; // 기동마다 새로 뽑아 ETag에 넣는다. 재시작 뒤 옛 ETag가 304를 받지 않게
+
+#define API_MAX_CONNS 256   // 넘으면 503으로 바로 닫는다
+#define API_IDLE_MS   10000 // 이만큼 주고받은 게 없으면 닫는다 (느린 요청/느린 수신 모두)
+
+typedef struct api_conn {
+    io_handler io; // 반드시 첫 멤버
+    int fd;
+    uint64_t active_ns;               // 마지막으로 주고받은 시각
+    struct api_conn *prev, *next;     // active_ns 순 목록. 앞쪽부터 유휴 연결을 닫는다
+    size_t got;
+    char req[2048];
+    msgbuf *out; // 보내는 중인 응답 (문서 버퍼 참조)
+    size_t out_off;
+    int closing; // 응답을 다 보내면 닫는다 (HTTP/1.0, Connection: close)
+} api_conn;
+
+api_conn *api_oldest, *api_newest;
+int api_conn_count = 0;
+int api_timerfd = -1;
+
+void api_unlink(api_conn *ac) {
+    if (ac->prev) ac->prev->next = ac->next;
+    else api_oldest = ac->next;
+    if (ac->next) ac->next->prev = ac->prev;
+    else api_newest = ac->prev;
+    ac->prev = ac->next = NULL;
+}
+
+/* 주고받은 게 있을 때마다 목록 끝으로 옮긴다 */
+void api_touch(api_conn *ac) {
+    ac->active_ns = now_ns();
+    if (api_newest == ac) return;
+    if (ac->prev || ac->next || api_oldest == ac) api_unlink(ac);
+    ac->prev = api_newest;
+    if (api_newest) api_newest->next = ac;
+    else api_oldest = ac;
+    api_newest = ac;
+}
+
+static const char *api_state_name(enum sensor_state st) {
+    return st == SENSOR_OK ? "ok" : st == SENSOR_READ_FAIL ? "read_fail" : "open_fail";
+}
+
+void api_render_sample(FILE *f, const sensor_sample *smp) {
+    fprintf(f, "{\"seq\":%lu,\"time_ms\":%lld,", smp->seq,
+            (long long)smp->ts.tv_sec * 1000 + smp->ts.tv_nsec / 1000000);
+    fprintf(f, "\"temp\":{\"status\":\"%s\",\"unit\":\"C\",\"value\":", api_state_name(smp->temp_state));
+    if (smp->temp_state == SENSOR_OK) fprintf(f, "%.1f},", smp->temp);
+    else fprintf(f, "null},");
+    fprintf(f, "\"pressure\":{\"status\":\"%s\",\"unit\":\"hPa\",\"value\":", api_state_name(smp->temp_state));
+    if (smp->temp_state == SENSOR_OK) fprintf(f, "%.2f},", smp->pressure / 100.0);
+    else fprintf(f, "null},");
+    fprintf(f, "\"lux\":{\"status\":\"%s\",\"unit\":\"lux\",\"value\":", api_state_name(smp->lux_state));
+    if (smp->lux_state == SENSOR_OK) fprintf(f, "%d}}\n", smp->lux);
+    else fprintf(f, "null}}\n");
+}
+
+/* /history와 같은 창(1m, 1h, 24h) */
+void api_render_history(FILE *f, unsigned long seq) {
+    static const char *windows[HIST_LEVELS] = { "1m", "1h", "24h" };
+    static const char *units[HIST_COUNT] = { "C", "hPa", "lux" };
+    fprintf(f, "{\"seq\":%lu", seq);
+    for (int m = 0; m < HIST_COUNT; m++) {
+        fprintf(f, ",\"%s\":{\"unit\":\"%s\"", hist_metric_names[m], units[m]);
+        for (int l = 0; l < HIST_LEVELS; l++) {
+            hist_bucket agg;
+            if (history_query(m, l, &agg) < 0)
+                fprintf(f, ",\"%s\":null", windows[l]);
+            else
+                fprintf(f, ",\"%s\":{\"count\":%u,\"avg\":%.2f,\"min\":%.2f,\"max\":%.2f}",
+                        windows[l], agg.count, agg.sum / agg.count, agg.min, agg.max);
+        }
+        fprintf(f, "}");
+    }
+    fprintf(f, "}\n");
+}
+
+/* 설정된 격자의 예보시각별 값. 없는 값은 null */
+void api_render_forecast(FILE *f, const forecast_snapshot *snap) {
+    if (!snap || !snap->ok) {
+        fprintf(f, "{\"ok\":false}\n");
+        return;
+    }
+    const forecast_table *t = &snap->table;
+    int g = forecast_find_grid(t, atoi(snap->nx), atoi(snap->ny));
+    fprintf(f, "{\"ok\":true,\"base_date\":\"%s\",\"base_time\":\"%s\",\"nx\":%s,\"ny\":%s,\"items\":[",
+            snap->base_date, snap->base_time, snap->nx, snap->ny);
+    for (int k = 0; g >= 0 && k < t->n_times; k++) {
+        fprintf(f, "%s{\"date\":\"%s\",\"time\":\"%04d\"", k ? "," : "", t->fcst_date[k], t->fcst_time[k]);
+        for (int c = 0; c < CAT_COUNT; c++) {
+            if (t->present[c][g][k]) fprintf(f, ",\"%s\":%g", kma_category_names[c], t->value[c][g][k]);
+            else fprintf(f, ",\"%s\":null", kma_category_names[c]);
+        }
+        fprintf(f, "}");
+    }
+    fprintf(f, "]}\n");
+}
+
+/* 데이터 버전이 바뀌었으면 응답 두 벌을 다시 만든다. 실패하면 이전 문서를 계속 쓴다 */
+void api_refresh(int id) {
+    api_doc *d = &api_docs[id];
+    sensor_sample smp;
+    forecast_snapshot *snap = NULL;
+    unsigned long version;
+    if (id == API_FORECAST) {
+        version = atomic_load(&forecast_gen);
+    } else {
+        sensor_snapshot(&smp);
+        version = smp.seq;
+    }
+    if (d->built && d->version == version) return;
+
+    char *body = NULL;
+    size_t len = 0;
+    FILE *f = open_memstream(&body, &len);
+    if (!f) return;
+    if (id == API_SAMPLE) {
+        api_render_sample(f, &smp);
+    } else if (id == API_HISTORY) {
+        api_render_history(f, version);
+    } else {
+        snap = forecast_get();
+        version = atomic_load(&forecast_gen); // 받은 스냅샷보다 새 버전이면 다음 요청 때 다시 만든다
+        api_render_forecast(f, snap);
+        forecast_put(snap);
+    }
+    if (fclose(f) != 0) {
+        free(body);
+        return;
+    }
+
+    char etag[48];
+    snprintf(etag, sizeof(etag), "\"%016llx-%c%lu\"", (unsigned long long)api_nonce, d->kind, version);
+    msgbuf *ok = msgbuf_printf("HTTP/1.1 200 OK\r\nContent-Type: application/json; charset=utf-8\r\n"
+                               "Content-Length: %zu\r\nETag: %s\r\nCache-Control: no-cache\r\n"
+                               "Access-Control-Allow-Origin: *\r\n\r\n%s", len, etag, body);
+    msgbuf *nm = msgbuf_printf("HTTP/1.1 304 Not Modified\r\nETag: %s\r\nCache-Control: no-cache\r\n"
+                               "Access-Control-Allow-Origin: *\r\n\r\n", etag);
+    free(body);
+    if (!ok || !nm) {
+        msgbuf_unref(ok);
+        msgbuf_unref(nm);
+        return;
+    }
+    // 보내는 중인 연결은 자기 참조를 들고 있으므로 바로 놓아도 된다
+    msgbuf_unref(d->ok);
+    msgbuf_unref(d->not_modified);
+    d->ok = ok;
+    d->not_modified = nm;
+    memcpy(d->etag, etag, sizeof(etag));
+    d->version = version;
+    d->built = 1;
+}
+
+/* 헤더 이름은 대소문자를 가리지 않는다. 값의 시작을 돌려준다 */
+const char *api_header(const char *req, const char *end, const char *name) {
+    size_t nlen = strlen(name);
+    for (const char *p = strstr(req, "\r\n"); p && p + 2 < end; p = strstr(p + 2, "\r\n")) {
+        if (strncasecmp(p + 2, name, nlen) == 0 && p[2 + nlen] == ':') {
+            const char *v = p + 3 + nlen;
+            while (*v == ' ' || *v == '\t') v++;
+            return v;
+        }
+    }
+    return NULL;
+}
+
+/* 요청 하나(헤더 끝 빈 줄까지, NUL로 끝남)에 대한 응답을 고른다 */
+msgbuf *api_route(api_conn *ac, const char *req, const char *end) {
+    char method[8], path[256], version[16];
+    if (sscanf(req, "%7s %255s %15s", method, path, version) != 3 || strncmp(version, "HTTP/1.", 7) != 0) {
+        ac->closing = 1;
+        return api_bad_request;
+    }
+    const char *conn = api_header(req, end, "Connection");
+    if (strcmp(version, "HTTP/1.0") == 0 || (conn && strncasecmp(conn, "close", 5) == 0)) ac->closing = 1;
+    path[strcspn(path, "?")] = '\0';
+    if (strcmp(method, "GET") != 0) return api_not_found;
+    for (int i = 0; i < API_DOCS; i++) {
+        if (strcmp(path, api_docs[i].path) != 0) continue;
+        api_refresh(i);
+        api_doc *d = &api_docs[i];
+        if (!d->built) return api_not_found;
+        const char *inm = api_header(req, end, "If-None-Match");
+        if (inm) {
+            const char *eol = strstr(inm, "\r\n");
+            size_t vlen = eol ? (size_t)(eol - inm) : strlen(inm);
+            if ((vlen == 1 && inm[0] == '*') || memmem(inm, vlen, d->etag, strlen(d->etag)))
+                return d->not_modified;
+        }
+        return d->ok;
+    }
+    return api_not_found;
+}
+
+void api_conn_close(api_conn *ac) {
+    api_unlink(ac);
+    api_conn_count--;
+    close(ac->fd); // epoll에서도 빠진다
+    msgbuf_unref(ac->out);
+    free(ac);
+}
+
+/* 보내는 중인 응답을 이어 보낸다. 다 보냈으면 1, 막혔으면 0, 오류면 -1 */
+int api_conn_flush(api_conn *ac) {
+    while (ac->out) {
+        ssize_t n = send(ac->fd, ac->out->data + ac->out_off, ac->out->len - ac->out_off, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+        if (n < 0) return -1;
+        metric_add(MC_BYTES_OUT, n);
+        api_touch(ac);
+        ac->out_off += n;
+        if (ac->out_off == ac->out->len) {
+            msgbuf_unref(ac->out);
+            ac->out = NULL;
+            ac->out_off = 0;
+        }
+    }
+    return 1;
+}
+
+/* keep-alive와 파이프라이닝: 앞 응답을 다 보낸 뒤에 다음 요청을 처리한다 */
+void on_api_conn_event(io_handler *h, uint32_t events) {
+    api_conn *ac = (api_conn *)h;
+    (void)events;
+    for (;;) {
+        int r = api_conn_flush(ac);
+        if (r < 0) {
+            api_conn_close(ac);
+            return;
+        }
+        if (r == 0) return; // EPOLLOUT에서 재개
+        if (ac->closing) {
+            api_conn_close(ac);
+            return;
+        }
+        char *end = memmem(ac->req, ac->got, "\r\n\r\n", 4);
+        if (end) {
+            size_t reqlen = end + 4 - ac->req;
+            end[2] = '\0'; // 마지막 헤더 줄의 \r\n은 남긴다
+            ac->out = msgbuf_ref(api_route(ac, ac->req, end + 2));
+            memmove(ac->req, ac->req + reqlen, ac->got - reqlen);
+            ac->got -= reqlen;
+            continue;
+        }
+        if (ac->got == sizeof(ac->req)) { // 헤더가 너무 길다
+            ac->out = msgbuf_ref(api_bad_request);
+            ac->closing = 1;
+            continue;
+        }
+        ssize_t n = recv(ac->fd, ac->req + ac->got, sizeof(ac->req) - ac->got, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (n <= 0) {
+            api_conn_close(ac);
+            return;
+        }
+        metric_add(MC_BYTES_IN, n);
+        api_touch(ac);
+        ac->got += n;
+    }
+}
+
+void on_api_listen_event(io_handler *h, uint32_t events) {
+    (void)h; (void)events;
+    while (server_running) {
+        int fd = accept4(api_sfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("api accept() error");
+            return;
+        }
+        if (api_conn_count >= API_MAX_CONNS) {
+            send(fd, api_unavailable->data, api_unavailable->len, MSG_NOSIGNAL | MSG_DONTWAIT);
+            close(fd);
+            continue;
+        }
+        api_conn *ac = calloc(1, sizeof(api_conn));
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, .data.ptr = ac };
+        if (!ac) {
+            close(fd);
+            continue;
+        }
+        ac->io.on_event = on_api_conn_event;
+        ac->fd = fd;
+        api_conn_count++;
+        api_touch(ac);
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+            api_conn_close(ac);
+            continue;
+        }
+        on_api_conn_event(&ac->io, EPOLLIN); // 요청이 이미 와 있을 수 있다
+    }
+}
+
+/* 1초마다 오래된 쪽부터 유휴 연결을 닫는다 */
+void on_api_timer(io_handler *h, uint32_t events) {
+    uint64_t expirations, now = now_ns();
+    (void)h; (void)events;
+    if (read(api_timerfd, &expirations, sizeof(expirations)) < 0 && errno == EAGAIN) return;
+    while (api_oldest && now - api_oldest->active_ns > (uint64_t)API_IDLE_MS * 1000000)
+        api_conn_close(api_oldest);
+}
+
+/* 기본은 루프백. 외부에 열려면 --api-bind 0.0.0.0 */
+int api_listen(const char *bind_addr, int port) {
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port) };
+    struct itimerspec its = { .it_interval = { 1, 0 }, .it_value = { 1, 0 } };
+    int yes = 1;
+    if (inet_pton(AF_INET, bind_addr, &addr.sin_addr) != 1) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (getrandom(&api_nonce, sizeof(api_nonce), 0) != sizeof(api_nonce))
+        api_nonce = now_ns() ^ (uint64_t)getpid() << 32;
+    api_not_found = msgbuf_printf("HTTP/1.1 404 Not Found\r\nContent-Type: application/json\r\n"
+                                  "Content-Length: 22\r\n\r\n{\"error\":\"not found\"}\n");
+    api_bad_request = msgbuf_printf("HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+    api_unavailable = msgbuf_printf("HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+    if (!api_not_found || !api_bad_request || !api_unavailable) return -1;
+    api_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (api_timerfd == -1 || timerfd_settime(api_timerfd, 0, &its, NULL) == -1) return -1;
+    api_sfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (api_sfd == -1) return -1;
+    setsockopt(api_sfd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    if (bind(api_sfd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(api_sfd, SOMAXCONN) == -1) {
+        close(api_sfd);
+        api_sfd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+void api_cleanup(void) {
+    while (api_oldest) api_conn_close(api_oldest);
+    if (api_sfd != -1) close(api_sfd);
+    if (api_timerfd != -1) close(api_timerfd);
+    for (int i = 0; i < API_DOCS; i++) {
+        msgbuf_unref(api_docs[i].ok);
+        msgbuf_unref(api_docs[i].not_modified);
+    }
+    msgbuf_unref(api_not_found);
+    msgbuf_unref(api_bad_request);
+    msgbuf_unref(api_unavailable);
+}
+
+io_handler listen_handler = { on_listen_event };
+io_handler metrics_listen_handler = { on_metrics_listen_event };
+io_handler api_listen_handler = { on_api_listen_event };
+io_handler api_timer_handler = { on_api_timer };
+
+/* ---- 워커 샤드 ---- */
+
+void on_shard_wake(io_handler *h, uint32_t events) {
+    shard *s = cur_shard;
+    uint64_t n;
+    shard_msg *m;
+    (void)h; (void)events;
+    if (read(s->wake_fd, &n, sizeof(n)) < 0 && errno != EAGAIN) perror("shard wake read");
+    atomic_store(&s->wake_pending, 0); // 비우기 전에 내려야 그 사이 들어온 메시지가 다시 깨운다
+    if (atomic_exchange(&s->sample_pending, 0)) {
+        sensor_sample smp;
+        sensor_snapshot(&smp);
+        sub_publish(&smp);
+    }
+    while ((m = mpsc_pop(&s->inbox)) != NULL) {
+        metric_record(MH_SHARD_QUEUE, now_ns() - m->posted_ns);
+        shard_deliver(m);
+        msgbuf_unref(m->text);
+        msgbuf_unref(m->bin);
+        free(m);
+    }
+}
+
+io_handler shard_wake_handler = { on_shard_wake };
+
+/* 같은 포트에 SO_REUSEPORT로 여러 리스너를 열면 커널이 연결을 워커별로 나눠 준다 */
+int shard_init(shard *s, int id) {
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(10000), .sin_addr.s_addr = htonl(INADDR_ANY) };
+    int yes = 1;
+    memset(s, 0, sizeof(*s));
+    s->id = id;
+    s->listen_fd = s->wake_fd = -1;
+    s->free_slot = UINT32_MAX;
+    mpsc_init(&s->inbox);
+    if ((s->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) == -1) return -1;
+    if ((s->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) return -1;
+    if ((s->listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1) return -1;
+    if (setsockopt(s->listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) == -1 ||
+        setsockopt(s->listen_fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) == -1) return -1;
+    if (bind(s->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) return -1;
+    if (listen(s->listen_fd, SOMAXCONN) == -1) return -1;
+    struct epoll_event lev = { .events = EPOLLIN | EPOLLET, .data.ptr = &listen_handler };
+    struct epoll_event wev = { .events = EPOLLIN, .data.ptr = &shard_wake_handler };
+    if (epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, s->listen_fd, &lev) == -1 ||
+        epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, s->wake_fd, &wev) == -1) return -1;
+    return 0;
+}
+
+void *shard_main(void *arg) {
+    struct epoll_event events[MAX_EVENTS];
+    cur_shard = arg;
+    while (server_running) {
+        int ready = epoll_wait(cur_shard->epoll_fd, events, MAX_EVENTS, 1000);
+        if (ready < 0) {
+            if (errno != EINTR) perror("epoll_wait() error");
+            continue;
+        }
+        for (int i = 0; i < ready; i++) {
+            io_handler *h = events[i].data.ptr;
+            h->on_event(h, events[i].events);
+        }
+    }
+    return NULL;
+}
+
+/* 워커가 끝난 뒤 main에서 호출. 전달되지 못한 방송과 클라이언트를 정리한다 */
+void shard_cleanup(shard *s) {
+    shard_msg *m;
+    while ((m = mpsc_pop(&s->inbox)) != NULL) {
+        msgbuf_unref(m->text);
+        msgbuf_unref(m->bin);
+        free(m);
+    }
+    for (int i = 0; i < s->client_count; i++) {
+        outq_clear(s->clients[i]);
+        free(s->clients[i]);
+    }
+    for (int i = 0; i < s->sub_bucket_count; i++)
+        for (int m = 0; m < HIST_COUNT; m++) free(s->sub_buckets[i].subs[m]);
+    free(s->clients);
+    free(s->slots);
+    if (s->listen_fd != -1) close(s->listen_fd);
+    if (s->wake_fd != -1) close(s->wake_fd);
+    close(s->epoll_fd);
+}
+io_handler stdin_handler = { on_stdin_event };
+
+void sigint_handler(int sig) {
+    (void)sig;
+    printf(COLOR_RED "\n[서버] Ctrl+C 신호 감지, 서버 종료 시작...\n" COLOR_RESET);
+    server_running = 0; // epoll_wait가 EINTR로 깨어나 메인 루프가 정리한다
+}
+
+void usage(const char *prog) {
+    fprintf(stderr, "사용법: %s [--slow-policy drop|latest|disconnect] [--queue-bytes N] [--kma-url URL] [--sample-ms N] [--bmp-oss 0-3] [--store-dir DIR] [--rules FILE] [--bmp-dev PATH] [--bh-dev PATH]\n"
+                    "        [--sensor chardev|synthetic[:SEED][:max]|replay:FILE[:N|max]] [--record FILE] [--metrics-port N] [--workers N] [--pool-threads N] [--backlog N] [--api-port N] [--api-bind ADDR]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    setlocale(LC_ALL, "");
+
+    static const struct option long_opts[] = {
+        { "slow-policy", required_argument, NULL, 'p' },
+        { "queue-bytes", required_argument, NULL, 'q' },
+        { "kma-url", required_argument, NULL, 'k' },
+        { "sample-ms", required_argument, NULL, 's' },
+        { "bmp-oss", required_argument, NULL, 'o' },
+        { "store-dir", required_argument, NULL, 'd' },
+        { "rules", required_argument, NULL, 'r' },
+        { "bmp-dev", required_argument, NULL, 'B' },
+        { "bh-dev", required_argument, NULL, 'L' },
+        { "sensor", required_argument, NULL, 'S' },
+        { "record", required_argument, NULL, 'R' },
+        { "metrics-port", required_argument, NULL, 'm' },
+        { "workers", required_argument, NULL, 'w' },
+        { "pool-threads", required_argument, NULL, 'P' },
+        { "api-port", required_argument, NULL, 'A' },
+        { "api-bind", required_argument, NULL, 'a' },
+        { "backlog", required_argument, NULL, 'b' },
+        { NULL, 0, NULL, 0 }
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "p:q:k:s:o:d:r:B:L:S:R:m:w:P:b:A:a:", long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 'p':
+            if (strcmp(optarg, "drop") == 0) slow_policy = SLOW_DROP;
+            else if (strcmp(optarg, "latest") == 0) slow_policy = SLOW_LATEST;
+            else if (strcmp(optarg, "disconnect") == 0) slow_policy = SLOW_DISCONNECT;
+            else usage(argv[0]);
+            break;
+        case 'q':
+            outq_limit = strtoul(optarg, NULL, 10);
+            if (outq_limit == 0) usage(argv[0]);
+            break;
+        case 'k':
+            kma_url = optarg; // 테스트용 대역 서버 등
+            break;
+        case 's':
+            sample_interval_ms = atoi(optarg);
+            if (sample_interval_ms <= 0) usage(argv[0]);
+            break;
+        case 'o':
+            bmp_oss = atoi(optarg);
+            if (bmp_oss < 0 || bmp_oss > 3) usage(argv[0]);
+            break;
+        case 'd':
+            store_dir = optarg;
+            break;
+        case 'r':
+            rules_path = optarg;
+            break;
+        case 'B':
+            bmp_dev = optarg;
+            break;
+        case 'L':
+            bh_dev = optarg;
+            break;
+        case 'S':
+            sensor_spec = optarg;
+            break;
+        case 'R':
+            sensor_record = fopen(optarg, "a");
+            if (!sensor_record) {
+                perror(optarg);
+                exit(1);
             }
+            fprintf(sensor_record, "# ts_ms,temp_state,temp_0.1C,pressure_Pa,lux_state,lux\n");
+            break;
+        case 'm':
+            metrics_port = atoi(optarg);
+            if (metrics_port <= 0 || metrics_port > 65535) usage(argv[0]);
+            break;
+        case 'w':
+            worker_count = atoi(optarg);
+            if (worker_count <= 0 || worker_count > 256) usage(argv[0]);
+            break;
+        case 'P':
+            pool_size = atoi(optarg);
+            if (pool_size <= 0 || pool_size > 64) usage(argv[0]);
+            break;
+        case 'A':
+            api_port = atoi(optarg);
+            if (api_port <= 0 || api_port > 65535) usage(argv[0]);
+            break;
+        case 'a':
+            api_bind = optarg;
+            break;
+        case 'b':
+            backlog_size = atoi(optarg);
+            if (backlog_size < 0 || backlog_size > BACKLOG_MAX) usage(argv[0]);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    struct sigaction sa;
+    sa.sa_handler = sigint_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    sigaction(SIGINT, &sa, NULL);
+    sa.sa_handler = SIG_IGN; // 끊긴 소켓에 쓰다가 서버 전체가 죽지 않도록
+    sigaction(SIGPIPE, &sa, NULL);
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+
+    // 스레드 없이 수만 개의 연결을 붙잡기 위해 fd 한도를 최대로
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    metrics_start = time(NULL);
+    if (history_init() < 0) {
+        perror("history_init");
+        exit(1);
+    }
+    if (rules_load(rules_path) < 0) exit(1);
+    if (store_dir && store_open(store_dir) < 0) {
+        perror("저장소 열기 실패");
+        exit(1);
+    }
+
+    if (sensor_backend_open(&sensor_src, sensor_spec) < 0) {
+        perror(sensor_spec);
+        exit(1);
+    }
+    // 워커 샤드: 각자 리스너와 epoll 루프를 갖는다. 센서 스레드보다 먼저 만들어 둔다
+    if (worker_count == 0) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        worker_count = ncpu > 0 ? (int)ncpu : 1;
+    }
+    if (!(shards = calloc(worker_count, sizeof(shard)))) {
+        perror("calloc() error");
+        exit(1);
+    }
+    for (shard_count = 0; shard_count < worker_count; shard_count++) {
+        if (shard_init(&shards[shard_count], shard_count) == -1) {
+            perror("worker listen() error");
+            exit(1);
+        }
+    }
+
+    if (pool_start() == -1) {
+        perror("pool_start");
+        exit(1);
+    }
+
+    pthread_t sensor_thread;
+    pthread_create(&sensor_thread, NULL, sensor_monitor, &sensor_src);
+
+    if ((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+        perror("epoll_create1() error");
+        exit(1);
+    }
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLET };
+    if (metrics_port) {
+        struct epoll_event mev = { .events = EPOLLIN | EPOLLET, .data.ptr = &metrics_listen_handler };
+        if (metrics_listen(metrics_port) == -1 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, metrics_sfd, &mev) == -1) {
+            perror("metrics listen() error");
+            exit(1);
+        }
+        printf(COLOR_CYAN "[서버] 지표: http://127.0.0.1:%d/metrics\n" COLOR_RESET, metrics_port);
+    }
+    if (api_port) {
+        struct epoll_event aev = { .events = EPOLLIN | EPOLLET, .data.ptr = &api_listen_handler };
+        struct epoll_event tev = { .events = EPOLLIN, .data.ptr = &api_timer_handler };
+        if (api_listen(api_bind, api_port) == -1 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, api_sfd, &aev) == -1 ||
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, api_timerfd, &tev) == -1) {
+            perror("api listen() error");
+            exit(1);
+        }
+        printf(COLOR_CYAN "[서버] API: http://%s:%d/api/{sample,history,forecast}\n" COLOR_RESET, api_bind, api_port);
+    }
+    if (http_init() == -1) {
+        perror("http_init() error");
+        exit(1);
+    }
+    // 기동 직후 한 번 받아오고 이후 발표 시각마다 갱신
+    forecast_seed = (unsigned int)time(NULL) ^ (unsigned int)getpid();
+    forecast_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    struct epoll_event fev = { .events = EPOLLIN, .data.ptr = &forecast_timer_handler };
+    if (forecast_timerfd == -1 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, forecast_timerfd, &fev) == -1) {
+        perror("timerfd_create() error");
+        exit(1);
+    }
+    forecast_kickfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    struct epoll_event kev = { .events = EPOLLIN, .data.ptr = &forecast_kick_handler };
+    if (forecast_kickfd == -1 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, forecast_kickfd, &kev) == -1) {
+        perror("eventfd() error");
+        exit(1);
+    }
+    forecast_schedule(0);
+
+    for (int i = 0; i < shard_count; i++)
+        pthread_create(&shards[i].thread, NULL, shard_main, &shards[i]);
+    printf(COLOR_CYAN "[서버] " COLOR_YELLOW "채팅 서버 시작!" COLOR_CYAN " 포트: 10000 (워커 %d개)\n" COLOR_RESET, shard_count);
+    printf(COLOR_CYAN "[서버] 채팅 입력 시 모든 클라이언트에게 " COLOR_YELLOW "공지" COLOR_CYAN "로 전송됩니다.\n" COLOR_RESET);
+    printf(COLOR_CYAN "[서버] " COLOR_YELLOW "센서 모니터링" COLOR_CYAN " 활성화됨\n" COLOR_RESET);
+
+    int flags = fcntl(STDIN_FILENO, F_GETFL, 0);
+    fcntl(STDIN_FILENO, F_SETFL, flags | O_NONBLOCK);
+    // stdin이 일반 파일이나 /dev/null이면 epoll에 넣을 수 없으므로 공지 입력만 비활성화
+    ev.data.ptr = &stdin_handler;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, STDIN_FILENO, &ev);
+
+    struct epoll_event events[MAX_EVENTS];
+    while (server_running) {
+        int ready = epoll_wait(epoll_fd, events, MAX_EVENTS, 1000);
+
+        if (ready < 0) {
+            if (!server_running || errno == EINTR) continue;
+            perror("epoll_wait() error");
+            continue;
+        }
+
+        for (int i = 0; i < ready; i++) {
+            io_handler *h = events[i].data.ptr;
+            h->on_event(h, events[i].events);
         }
+        http_reap_sockets();
     }
 
     printf(COLOR_RED "[서버] 메인 루프 종료, 모든 리소스 정리 중...\n" COLOR_RESET);
     server_running = 0;
     pthread_join(sensor_thread, NULL);
+    for (int i = 0; i < shard_count; i++) shard_wake(&shards[i]);
+    for (int i = 0; i < shard_count; i++) pthread_join(shards[i].thread, NULL);
+    pool_shutdown();
+    backlog_cleanup();
+    if (sensor_record) fclose(sensor_record);
+    history_cleanup();
+    store_close();
+    rules_cleanup();
+    http_cleanup();
+    close(forecast_timerfd);
+    close(forecast_kickfd);
+    forecast_publish(NULL);
 
-    pthread_mutex_lock(&mutex);
-    for (int i = 0; i < client_count; i++) {
-        close(clients[i].sockfd);
-    }
-    client_count = 0;
-    pthread_mutex_unlock(&mutex);
+    broadcast_shutdown();
+    for (int i = 0; i < shard_count; i++) shard_cleanup(&shards[i]);
+    free(shards);
 
-    if (server_sfd != -1) {
-        close(server_sfd);
-    }
+    if (metrics_sfd != -1) close(metrics_sfd);
+    api_cleanup();
+    metrics_cleanup();
+    close(epoll_fd);
     curl_global_cleanup();
     printf(COLOR_RED "[서버] 종료 완료\n" COLOR_RESET);
     return 0;
-}
\ No newline at end of file
+}
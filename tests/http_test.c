@@ -0,0 +1,252 @@
+/*
+ * 비동기 HTTP(curl_multi + epoll) 검사. 루프백에 가짜 기상청 서버를 띄워
+ * 응답 지연을 바꿔 가며 동시 요청, 연결 재사용, 시간 초과, 예보 갱신 전체 흐름을 확인한다.
+ *
+ *   make check
+ */
+#define main server_main
+#include "../server.c"
+#undef main
+
+int failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        printf("  실패 %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+        failures++; \
+    } \
+} while (0)
+
+/* ---- 가짜 기상청: keep-alive로 같은 본문을 delay_ms 뒤에 돌려준다 ---- */
+
+int fake_port;
+char fake_body[16384];
+size_t fake_body_len;
+atomic_int fake_delay_ms = 0;
+atomic_int fake_accepts = 0;
+atomic_int fake_requests = 0;
+
+/* 지금 발표분(base_time + 1시)부터 6시간. /weather가 바로 찾을 수 있게 */
+size_t make_body(char *buf, size_t cap) {
+    static const char *cats[] = { "T1H", "SKY", "PTY", "REH" };
+    static const char *vals[] = { "21.5", "3", "0", "60" };
+    char base_date[9], base_time[5];
+    get_kma_date_time(base_date, base_time);
+    int h0 = atoi(base_time) / 100 + 1;
+    size_t len = snprintf(buf, cap, "{\"response\":{\"header\":{\"resultCode\":\"00\",\"resultMsg\":\"NORMAL_SERVICE\"},"
+                                    "\"body\":{\"items\":{\"item\":[");
+    for (int c = 0; c < 4; c++)
+        for (int k = 0; k < FCST_MAX_TIMES; k++)
+            len += snprintf(buf + len, cap - len,
+                "%s{\"category\":\"%s\",\"fcstDate\":\"%s\",\"fcstTime\":\"%02d00\",\"fcstValue\":\"%s\",\"nx\":%s,\"ny\":%s}",
+                c || k ? "," : "", cats[c], base_date, (h0 + k) % 24, vals[c], KMA_NX, KMA_NY);
+    len += snprintf(buf + len, cap - len, "]}}}}");
+    return len;
+}
+
+void *fake_conn_thread(void *arg) {
+    int fd = (int)(intptr_t)arg;
+    char req[4096];
+    size_t have = 0;
+    for (;;) {
+        ssize_t n = read(fd, req + have, sizeof(req) - 1 - have);
+        if (n <= 0) break;
+        have += n;
+        req[have] = '\0';
+        char *end;
+        while ((end = strstr(req, "\r\n\r\n")) != NULL) {
+            atomic_fetch_add(&fake_requests, 1);
+            usleep(atomic_load(&fake_delay_ms) * 1000);
+            char hdr[256];
+            int hl = snprintf(hdr, sizeof(hdr), "HTTP/1.1 200 OK\r\nContent-Type: application/json;charset=UTF-8\r\n"
+                                                "Content-Length: %zu\r\n\r\n", fake_body_len);
+            if (write(fd, hdr, hl) < 0 || write(fd, fake_body, fake_body_len) < 0) goto out;
+            size_t used = end + 4 - req;
+            memmove(req, req + used, have - used + 1);
+            have -= used;
+        }
+    }
+out:
+    close(fd);
+    return NULL;
+}
+
+void *fake_accept_thread(void *arg) {
+    int lfd = (int)(intptr_t)arg;
+    for (;;) {
+        int fd = accept(lfd, NULL, NULL);
+        if (fd < 0) continue;
+        atomic_fetch_add(&fake_accepts, 1);
+        pthread_t tid;
+        pthread_create(&tid, NULL, fake_conn_thread, (void *)(intptr_t)fd);
+        pthread_detach(tid);
+    }
+    return NULL;
+}
+
+void fake_start(void) {
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t alen = sizeof(addr);
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (lfd < 0 || bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(lfd, 64) == -1 ||
+        getsockname(lfd, (struct sockaddr *)&addr, &alen) == -1) {
+        perror("가짜 기상청 서버");
+        exit(1);
+    }
+    fake_port = ntohs(addr.sin_port);
+    fake_body_len = make_body(fake_body, sizeof(fake_body));
+    pthread_t tid;
+    pthread_create(&tid, NULL, fake_accept_thread, (void *)(intptr_t)lfd);
+    pthread_detach(tid);
+}
+
+/* ---- 서버와 같은 방식으로 epoll 루프를 돌린다 ---- */
+
+typedef struct {
+    kma_parser parser;
+    forecast_table table;
+    int done;
+    CURLcode res;
+    long status;
+} fetch;
+
+void on_fetch_data(http_request *req, const char *data, size_t len) {
+    fetch *f = req->user;
+    kma_parser_feed(&f->parser, data, len);
+}
+
+void on_fetch_done(http_request *req, CURLcode res, long status) {
+    fetch *f = req->user;
+    f->done = 1;
+    f->res = res;
+    f->status = status;
+}
+
+/* 모든 요청이 끝나거나 limit_ms가 지날 때까지 */
+void run_until_done(fetch *f, int n, int limit_ms) {
+    uint64_t deadline = now_ns() + (uint64_t)limit_ms * 1000000;
+    struct epoll_event events[MAX_EVENTS];
+    for (;;) {
+        int pending = 0;
+        for (int i = 0; i < n; i++) pending += !f[i].done;
+        if (!pending || now_ns() > deadline) return;
+        int ready = epoll_wait(epoll_fd, events, MAX_EVENTS, 50);
+        for (int i = 0; i < ready; i++) {
+            io_handler *h = events[i].data.ptr;
+            h->on_event(h, events[i].events);
+        }
+        http_reap_sockets();
+    }
+}
+
+void start_fetch(fetch *f, long timeout_ms) {
+    char url[128];
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/getUltraSrtFcst?numOfRows=60", fake_port);
+    memset(f, 0, sizeof(*f));
+    kma_parser_init(&f->parser, &f->table);
+    CHECK(http_get(url, timeout_ms, on_fetch_data, on_fetch_done, f) != NULL);
+}
+
+void test_concurrent(void) {
+    enum { N = 8, DELAY = 300 };
+    static fetch f[N];
+    printf("동시 요청 %d개, 응답마다 %dms 지연\n", N, DELAY);
+    atomic_store(&fake_delay_ms, DELAY);
+    uint64_t t0 = now_ns();
+    for (int i = 0; i < N; i++) start_fetch(&f[i], 5000);
+    run_until_done(f, N, 5000);
+    double ms = (now_ns() - t0) / 1e6;
+    printf("  %.0fms 걸림 (직렬이면 %dms)\n", ms, N * DELAY);
+    CHECK(ms < 2 * DELAY);
+    for (int i = 0; i < N; i++) {
+        CHECK(f[i].done && f[i].res == CURLE_OK && f[i].status == 200);
+        CHECK(f[i].table.n_times == FCST_MAX_TIMES && f[i].table.present[CAT_T1H][0][0]);
+    }
+}
+
+void test_reuse(void) {
+    enum { N = 5 };
+    static fetch f;
+    printf("연속 요청 %d개는 연결을 다시 쓴다\n", N);
+    atomic_store(&fake_delay_ms, 0);
+    int accepts = atomic_load(&fake_accepts), requests = atomic_load(&fake_requests);
+    for (int i = 0; i < N; i++) {
+        start_fetch(&f, 5000);
+        run_until_done(&f, 1, 5000);
+        CHECK(f.done && f.res == CURLE_OK);
+    }
+    printf("  요청 %d개, 새 연결 %d개\n", atomic_load(&fake_requests) - requests, atomic_load(&fake_accepts) - accepts);
+    CHECK(atomic_load(&fake_requests) - requests == N);
+    CHECK(atomic_load(&fake_accepts) == accepts);
+}
+
+void test_timeout(void) {
+    static fetch slow, fast;
+    printf("시간 초과는 루프를 막지 않는다\n");
+    atomic_store(&fake_delay_ms, 600);
+    uint64_t t0 = now_ns();
+    start_fetch(&slow, 150);
+    run_until_done(&slow, 1, 3000);
+    double ms = (now_ns() - t0) / 1e6;
+    printf("  %.0fms 만에 실패: %s\n", ms, curl_easy_strerror(slow.res));
+    CHECK(slow.done && slow.res == CURLE_OPERATION_TIMEDOUT);
+    CHECK(ms < 500);
+    atomic_store(&fake_delay_ms, 0);
+    usleep(700000); // 가짜 서버가 늦은 응답을 끝내도록
+    start_fetch(&fast, 5000);
+    run_until_done(&fast, 1, 3000);
+    CHECK(fast.done && fast.res == CURLE_OK);
+}
+
+void test_forecast_refresh(void) {
+    char url[128];
+    printf("forecast_start -> 파싱 -> 스냅샷 게시\n");
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/getUltraSrtFcst", fake_port);
+    kma_url = url;
+    forecast_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    unsigned long gen = atomic_load(&forecast_gen);
+    forecast_start();
+    CHECK(forecast_inflight);
+    uint64_t deadline = now_ns() + 3000000000ULL;
+    struct epoll_event events[MAX_EVENTS];
+    while (forecast_inflight && now_ns() < deadline) {
+        int ready = epoll_wait(epoll_fd, events, MAX_EVENTS, 50);
+        for (int i = 0; i < ready; i++) {
+            io_handler *h = events[i].data.ptr;
+            h->on_event(h, events[i].events);
+        }
+        http_reap_sockets();
+    }
+    forecast_snapshot *snap = forecast_get();
+    CHECK(atomic_load(&forecast_gen) == gen + 1);
+    CHECK(snap && snap->ok);
+    if (snap) {
+        CHECK(strstr(snap->msg->data, "21.5") != NULL);
+        CHECK(snap->bin->data[0] == WIRE_FORECAST);
+    }
+    forecast_put(snap);
+    close(forecast_timerfd);
+}
+
+int main(void) {
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    signal(SIGPIPE, SIG_IGN);
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    fake_start();
+    if ((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) == -1 || http_init() == -1) {
+        perror("http_init");
+        return 1;
+    }
+    test_concurrent();
+    test_reuse();
+    test_timeout();
+    test_forecast_refresh();
+    http_cleanup();
+    curl_global_cleanup();
+    if (failures) {
+        printf("http: %d개 실패\n", failures);
+        return 1;
+    }
+    printf("http: 통과\n");
+    return 0;
+}
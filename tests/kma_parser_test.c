@@ -0,0 +1,212 @@
+/*
+ * kma_parser 검사: 녹음해 둔 getUltraSrtFcst 응답 모양의 본문을 통째로, 잘게 쪼개서,
+ * 깨진 채로 흘려 넣고 forecast_table 내용을 확인한다. 마지막에 처리량을 잰다.
+ *
+ *   make check
+ */
+#define main server_main
+#include "../server.c"
+#undef main
+
+int failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        printf("  실패 %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+        failures++; \
+    } \
+} while (0)
+
+#define CHECK_FLOAT(a, b) CHECK(fabsf((a) - (b)) < 0.001f)
+
+/* 실제 응답처럼 들여쓰기, 이스케이프, 한글 값이 섞인 본문. 두 격자 x 10개 범주 x 6시간 */
+static const char *cats[CAT_COUNT] = { "T1H", "RN1", "SKY", "UUU", "VVV", "REH", "PTY", "LGT", "VEC", "WSD" };
+
+size_t canned_body(char *buf, size_t cap, const char *result_code) {
+    size_t len = snprintf(buf, cap,
+        "{\"response\":{\n  \"header\":{\"resultCode\":\"%s\",\"resultMsg\":\"NORMAL \\\"SERVICE\\\"\"},\n"
+        "  \"body\":{\"dataType\":\"JSON\",\"items\":{\"item\":[\n", result_code);
+    int first = 1;
+    for (int g = 0; g < 2; g++) {
+        for (int c = 0; c < CAT_COUNT; c++) {
+            for (int k = 0; k < 6; k++) {
+                char val[32];
+                if (c == CAT_RN1) snprintf(val, sizeof(val), "%s", k == 0 ? "강수없음" : k == 1 ? "1mm 미만" : "30.0~50.0mm");
+                else if (c == CAT_T1H) snprintf(val, sizeof(val), "%.1f", 20.0 + g * 5 + k * 0.5);
+                else if (c == CAT_VVV) snprintf(val, sizeof(val), "-%d.%d", k, g);
+                else snprintf(val, sizeof(val), "%d", c * 10 + k);
+                len += snprintf(buf + len, cap - len,
+                    "%s    {\"baseDate\":\"20250101\",\"baseTime\":\"2330\",\"category\":\"%s\","
+                    "\"fcstDate\":\"%s\",\"fcstTime\":\"%02d00\",\"fcstValue\":\"%s\",\"nx\":%d,\"ny\":%d}",
+                    first ? "" : ",\n", cats[c], k == 0 ? "20250101" : "20250102", k == 0 ? 0 : k, val,
+                    g ? 60 : 58, g ? 127 : 125);
+                first = 0;
+            }
+        }
+    }
+    len += snprintf(buf + len, cap - len, "\n  ]},\"pageNo\":1,\"numOfRows\":120,\"totalCount\":120}}}\n");
+    return len;
+}
+
+void parse_whole(forecast_table *t, const char *body, size_t len) {
+    kma_parser p;
+    kma_parser_init(&p, t);
+    kma_parser_feed(&p, body, len);
+}
+
+/* 청크 크기를 바꿔 가며 흘려 넣는다 (curl write callback이 주는 것처럼) */
+void parse_chunked(forecast_table *t, const char *body, size_t len, size_t chunk) {
+    kma_parser p;
+    kma_parser_init(&p, t);
+    for (size_t off = 0; off < len; off += chunk)
+        kma_parser_feed(&p, body + off, len - off < chunk ? len - off : chunk);
+}
+
+void test_whole_body(void) {
+    static char body[65536];
+    static forecast_table t;
+    size_t len = canned_body(body, sizeof(body), "00");
+    printf("본문 한 번에 (%zu바이트)\n", len);
+    parse_whole(&t, body, len);
+
+    CHECK(strcmp(t.result_code, "00") == 0);
+    CHECK(t.n_grids == 2);
+    CHECK(t.n_times == 6);
+    CHECK(t.nx[0] == 58 && t.ny[0] == 125);
+    CHECK(t.nx[1] == 60 && t.ny[1] == 127);
+    CHECK(t.fcst_time[0] == 0 && strcmp(t.fcst_date[0], "20250101") == 0);
+    CHECK(t.fcst_time[5] == 500 && strcmp(t.fcst_date[5], "20250102") == 0);
+    for (int c = 0; c < CAT_COUNT; c++)
+        for (int g = 0; g < 2; g++)
+            for (int k = 0; k < 6; k++) CHECK(t.present[c][g][k]);
+    CHECK_FLOAT(t.value[CAT_T1H][0][0], 20.0f);
+    CHECK_FLOAT(t.value[CAT_T1H][1][5], 27.5f);
+    CHECK_FLOAT(t.value[CAT_RN1][0][0], 0.0f);  // 강수없음
+    CHECK_FLOAT(t.value[CAT_RN1][0][1], 1.0f);  // 1mm 미만
+    CHECK_FLOAT(t.value[CAT_RN1][0][2], 30.0f); // 30.0~50.0mm
+    CHECK_FLOAT(t.value[CAT_VVV][1][3], -3.1f);
+    CHECK_FLOAT(t.value[CAT_WSD][0][4], 94.0f);
+
+    int g = forecast_find_grid(&t, 60, 127), k = forecast_find_time(&t, 300);
+    CHECK(g == 1 && k == 3);
+    CHECK_FLOAT(t.value[CAT_REH][g][k], 53.0f);
+}
+
+void test_chunks(void) {
+    static char body[65536];
+    static forecast_table ref, t;
+    size_t len = canned_body(body, sizeof(body), "00");
+    parse_whole(&ref, body, len);
+
+    printf("청크 크기 1..97\n");
+    for (size_t chunk = 1; chunk < 98; chunk++) {
+        parse_chunked(&t, body, len, chunk);
+        CHECK(memcmp(&t, &ref, sizeof(t)) == 0);
+    }
+    printf("두 조각으로 나눌 수 있는 모든 위치\n");
+    for (size_t cut = 0; cut <= len; cut++) {
+        kma_parser p;
+        kma_parser_init(&p, &t);
+        kma_parser_feed(&p, body, cut);
+        kma_parser_feed(&p, body + cut, len - cut);
+        if (memcmp(&t, &ref, sizeof(t)) != 0) {
+            printf("  실패: %zu에서 나누면 표가 다름\n", cut);
+            failures++;
+            break;
+        }
+    }
+}
+
+void test_bad_input(void) {
+    static char body[65536];
+    static forecast_table t;
+    char reply[BUF_SIZE];
+
+    printf("오류 응답 (NO_DATA)\n");
+    const char *nodata = "{\"response\":{\"header\":{\"resultCode\":\"03\",\"resultMsg\":\"NO_DATA\"}}}";
+    parse_whole(&t, nodata, strlen(nodata));
+    CHECK(strcmp(t.result_code, "03") == 0);
+    CHECK(t.n_times == 0 && t.n_grids == 0);
+    CHECK(kma_render_weather(&t, "2330", reply, sizeof(reply)) == -1);
+
+    printf("XML 오류 본문 (인증키 오류)\n");
+    const char *xml = "<OpenAPI_ServiceResponse><cmmMsgHeader><errMsg>SERVICE ERROR</errMsg>"
+                      "<returnAuthMsg>SERVICE_KEY_IS_NOT_REGISTERED_ERROR</returnAuthMsg>"
+                      "<returnReasonCode>30</returnReasonCode></cmmMsgHeader></OpenAPI_ServiceResponse>";
+    parse_whole(&t, xml, strlen(xml));
+    CHECK(t.result_code[0] == '\0');
+    CHECK(t.n_times == 0 && t.n_grids == 0);
+    CHECK(kma_render_weather(&t, "2330", reply, sizeof(reply)) == -1);
+
+    printf("중간에 끊긴 본문\n");
+    size_t len = canned_body(body, sizeof(body), "00");
+    char *cut = strstr(body, "\"category\":\"SKY\"");
+    CHECK(cut != NULL);
+    parse_whole(&t, body, cut - body);
+    CHECK(t.n_times == 6 && t.n_grids == 1);
+    CHECK(t.present[CAT_RN1][0][5]);
+    CHECK(!t.present[CAT_SKY][0][0]); // 닫히지 않은 항목은 반영하지 않는다
+    (void)len;
+
+    printf("빈 본문, 짝이 안 맞는 따옴표, 긴 토큰\n");
+    parse_whole(&t, "", 0);
+    CHECK(t.n_times == 0);
+    const char *junk = "{\"item\":[{\"category\":\"T1H\",\"fcstTime\":\"0100\",\"fcstValue\":\""
+                       "12345678901234567890123456789012345678901234567890\",\"nx\":58,\"ny\":125},"
+                       "{\"category\":\"T1H\",\"fcstTime\":\"0200\",\"fcstValue\":\"3.5}]}";
+    parse_whole(&t, junk, strlen(junk));
+    CHECK(t.n_times == 1); // 두 번째 항목은 문자열이 닫히지 않아 버려진다
+    CHECK(t.present[CAT_T1H][0][0]);
+
+    printf("모르는 범주와 표 크기를 넘는 시각/격자\n");
+    len = 0;
+    len += snprintf(body + len, sizeof(body) - len, "{\"item\":[");
+    for (int k = 0; k < FCST_MAX_TIMES + 3; k++)
+        len += snprintf(body + len, sizeof(body) - len,
+            "{\"category\":\"T1H\",\"fcstDate\":\"20250101\",\"fcstTime\":\"%02d00\",\"fcstValue\":\"1\",\"nx\":58,\"ny\":125},", k);
+    for (int g = 0; g < FCST_MAX_GRIDS + 3; g++)
+        len += snprintf(body + len, sizeof(body) - len,
+            "{\"category\":\"SKY\",\"fcstDate\":\"20250101\",\"fcstTime\":\"0000\",\"fcstValue\":\"1\",\"nx\":%d,\"ny\":1},", g);
+    len += snprintf(body + len, sizeof(body) - len,
+        "{\"category\":\"XYZ\",\"fcstDate\":\"20250101\",\"fcstTime\":\"0000\",\"fcstValue\":\"9\",\"nx\":58,\"ny\":125}]}");
+    parse_whole(&t, body, len);
+    CHECK(t.n_times == FCST_MAX_TIMES);
+    CHECK(t.n_grids == FCST_MAX_GRIDS);
+}
+
+void test_render(void) {
+    static char body[65536];
+    static forecast_table t;
+    char reply[BUF_SIZE];
+    printf("/weather 문장 (2330 발표 -> 0000시)\n");
+    parse_whole(&t, body, canned_body(body, sizeof(body), "00"));
+    CHECK(kma_render_weather(&t, "2330", reply, sizeof(reply)) == 0);
+    CHECK(strstr(reply, "00시 예보") != NULL);
+    CHECK(strstr(reply, "20") != NULL);
+}
+
+void bench(void) {
+    static char body[65536];
+    static forecast_table t;
+    size_t len = canned_body(body, sizeof(body), "00");
+    int n = 2000;
+    uint64_t t0 = now_ns();
+    for (int i = 0; i < n; i++) parse_chunked(&t, body, len, 16384); // curl의 기본 write 크기
+    double sec = (now_ns() - t0) / 1e9;
+    printf("처리량: %zu바이트 본문 %d회, %.1f MB/s, 본문당 %.1f us\n",
+           len, n, len * (double)n / sec / 1e6, sec * 1e6 / n);
+}
+
+int main(void) {
+    test_whole_body();
+    test_chunks();
+    test_bad_input();
+    test_render();
+    bench();
+    if (failures) {
+        printf("kma_parser: %d개 실패\n", failures);
+        return 1;
+    }
+    printf("kma_parser: 통과\n");
+    return 0;
+}
@@ -0,0 +1,117 @@
+#ifndef WIRE_PROTO_H
+#define WIRE_PROTO_H
+
+/*
+ * server.c와 client.c가 공유하는 바이너리 프레임 프로토콜.
+ *
+ * 협상: 접속 직후 닉네임을 보내기 전에 WIRE_HELLO_LINE 한 줄을 보낸다.
+ * 서버는 WIRE_HELLO 프레임으로 답하고, 그 뒤로 서버 -> 클라이언트 방향은 모두 프레임이다.
+ * 텍스트에는 NUL이 없으므로 클라이언트는 첫 NUL 바이트(= WIRE_HELLO 타입)부터 프레임으로 읽는다.
+ * 클라이언트 -> 서버 방향(닉네임, 채팅, 명령어)은 그대로 줄 단위 텍스트다.
+ *
+ * 프레임: type(u8) | len(u16, big-endian) | payload[len]
+ * 정수는 모두 big-endian, 문자열은 색상 코드 없는 UTF-8이다.
+ *
+ * 압축: 닉네임 전에 WIRE_DEFLATE_LINE을 보내면 (텍스트/바이너리 어느 쪽이든)
+ * 서버가 flags에 WIRE_HELLO_DEFLATE를 켠 WIRE_HELLO로 답하고, 그 뒤 모든 메시지를 WIRE_DEFLATE로 감싼다.
+ * 풀면 압축하지 않았을 때 받았을 바이트(텍스트 줄 또는 프레임)가 그대로 나온다.
+ * 프레임마다 wire_deflate_dict를 미리 넣은 raw deflate(windowBits -15)를 새로 시작하므로
+ * 앞 프레임과 상태를 공유하지 않고, 서버는 같은 메시지를 한 번만 압축해 모든 수신자에게 보낸다.
+ * 원문이 WIRE_DEFLATE_CHUNK보다 길면 여러 프레임으로 나뉘고, 프레임 경계가 중간에 올 수 있다.
+ */
+
+#include <stdint.h>
+
+#define WIRE_HELLO_LINE "\002WXB1\n"
+#define WIRE_DEFLATE_LINE "\002WXZ1\n"
+#define WIRE_VERSION    1
+#define WIRE_HDR_SIZE   3
+#define WIRE_MAX_PAYLOAD 65535
+#define WIRE_DEFLATE_CHUNK 32768 /* WIRE_DEFLATE 하나에 담는 원문 상한 */
+#define WIRE_HELLO_DEFLATE 0x01
+
+enum wire_type {
+    WIRE_HELLO    = 0, /* u8 version | u8 flags (없으면 0) */
+    WIRE_TEXT     = 1, /* 서버 안내/명령 응답: text */
+    WIRE_CHAT     = 2, /* u8 nick_len | nick | text */
+    WIRE_SAMPLE   = 3, /* struct wire_sample */
+    WIRE_FORECAST = 4, /* base_date[8] | base_time[4] | u8 n | wire_forecast_entry[n] */
+    WIRE_NOTICE   = 5, /* u8 name_len | name | text (공지 규칙, 운영자 공지는 name_len 0) */
+    WIRE_DEFLATE  = 6, /* raw deflate, wire_deflate_dict */
+};
+
+/*
+ * 압축 사전. 서버가 보내는 문구 틀(색상 코드, 고정 안내문, 예보/센서 줄)을 모았다.
+ * deflate는 사전 끝쪽을 더 싸게 참조하므로 자주 나오는 문구일수록 뒤에 둔다.
+ * 바꾸면 서버와 클라이언트가 함께 바뀌어야 하므로 WIRE_DEFLATE_LINE의 버전도 올린다.
+ */
+static const char wire_deflate_dict[] =
+    "[서버] 저장소가 꺼져 있습니다. (--store-dir)\n"
+    "[서버] 요청이 많습니다. 잠시 후 다시 시도해 주세요.\n"
+    "[서버] 알 수 없는 명령어입니다. 명령어 목록: /temp, /lux, /weather, /history, /range, /subscribe, /unsubscribe\n"
+    "[서버] 기상청 예보를 아직 받아오지 못했습니다.\n"
+    "[서버] 기상청 API에서 해당 시간의 날씨 데이터를 찾을 수 없습니다.\n"
+    "[서버] 서버가 종료됩니다. 연결을 종료합니다.\n"
+    "\033[36m[알림] 당신의 ID는 \033[32m 입니다. ☀️'\033[33m웨더\033[36m'에 오신걸 환영합니다.\n\033[0m"
+    "[서버] 구독을 해지했습니다.\n[서버] 를 ms마다 보내드립니다.\n"
+    "[서버] 저장된 최근 온도 기압 조도: 평균 \033[33m\033[0m°C, 최저 hPa, 최고 lux (샘플 개) 초과 개 (%)\n"
+    "\033[36m[서버]\033[0m 온도 센서 읽기 실패\n\033[36m[서버]\033[0m 조도 센서 장치 열기 실패\n"
+    "\033[33m📍\033[0m강서구 화곡동 00시 예보: 🌧️🌨️☀️☁️⛅맑음, 구름많음, 흐림, 강수없음, 비, 비/눈, 눈, 기온 \033[33m"
+    "[서버] 현재 온도 \033[33m\033[0m°C, 기압 1013. hPa, 조도 \033[33m\033[0m lux\n"
+    "[서버] 현재 온도: \033[33m\033[0m°C\n[서버] 현재 조도: \033[33m\033[0m lux\n"
+    "\033[33m[공지]\033[0m \n\033[0m"
+    "\033[0m: \n\033[0m";
+
+
+/* WIRE_SAMPLE payload (21바이트) */
+#define WIRE_SAMPLE_SIZE 21
+/*
+ *  0 u64 timestamp_ms  CLOCK_REALTIME
+ *  8 u8  topic         0 temp, 1 pressure, 2 lux (구독 갱신이나 응답이 가리키는 신호)
+ *  9 u8  temp_state    0 정상, 1 읽기 실패, 2 장치 열기 실패 (기압도 같은 센서)
+ * 10 u8  lux_state
+ * 11 s16 temperature   0.1 °C
+ * 13 u32 pressure      Pa
+ * 17 u32 lux
+ */
+
+/* WIRE_FORECAST 항목 (11바이트). 값이 없으면 모든 비트가 1 */
+#define WIRE_FORECAST_ENTRY_SIZE 11
+/*
+ *  0 u16 fcst_time  HHMM
+ *  2 s16 t1h        0.1 °C
+ *  4 u8  sky        1 맑음, 3 구름많음, 4 흐림
+ *  5 u8  pty        0 없음, 1 비, 2 비/눈, 3 눈, 5~7 빗방울/눈날림
+ *  6 u16 rn1        0.1 mm
+ *  8 u8  reh        %
+ *  9 u16 wsd        0.1 m/s
+ */
+
+static inline void wire_put16(unsigned char *p, uint16_t v) {
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static inline void wire_put32(unsigned char *p, uint32_t v) {
+    wire_put16(p, v >> 16);
+    wire_put16(p + 2, v);
+}
+
+static inline void wire_put64(unsigned char *p, uint64_t v) {
+    wire_put32(p, v >> 32);
+    wire_put32(p + 4, v);
+}
+
+static inline uint16_t wire_get16(const unsigned char *p) {
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static inline uint32_t wire_get32(const unsigned char *p) {
+    return (uint32_t)wire_get16(p) << 16 | wire_get16(p + 2);
+}
+
+static inline uint64_t wire_get64(const unsigned char *p) {
+    return (uint64_t)wire_get32(p) << 32 | wire_get32(p + 4);
+}
+
+#endif